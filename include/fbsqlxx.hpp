@@ -2,11 +2,20 @@
 
 #include <firebird/Interface.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
 #include <cstring>
 #include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -17,6 +26,20 @@
 #define FBSQLXX_EXCEPTION_BUFFER_SIZE 512
 #endif // !FBSQLXX_EXCEPTION_BUFFER_SIZE
 
+// bytes of one block of row_table, a block holds at least one row
+#ifndef FBSQLXX_ROW_TABLE_BLOCK_SIZE
+#define FBSQLXX_ROW_TABLE_BLOCK_SIZE (256 * 1024)
+#endif // !FBSQLXX_ROW_TABLE_BLOCK_SIZE
+
+// check that statements, result sets and blobs are not used by several threads at once
+#ifndef FBSQLXX_CHECK_CONCURRENT_USE
+#ifdef NDEBUG
+#define FBSQLXX_CHECK_CONCURRENT_USE 0
+#else
+#define FBSQLXX_CHECK_CONCURRENT_USE 1
+#endif
+#endif // !FBSQLXX_CHECK_CONCURRENT_USE
+
 
 namespace fbsqlxx {
 
@@ -85,11 +108,43 @@ class sql_error : public error
 public:
     sql_error(const char* msg, const Firebird::FbException* cause)
         : error(msg), _cause{ cause }
-    {}
+    {
+        if (!cause)
+            return;
+
+        // keep error codes, the cause does not outlive the handler which throws sql_error
+        auto v = cause->getStatus()->getErrors();
+        while (*v != isc_arg_end)
+        {
+            switch (*v++)
+            {
+            case isc_arg_gds:
+                _codes.push_back(*v++);
+                break;
+            case isc_arg_cstring:
+                v += 2;
+                break;
+            default:
+                ++v;
+                break;
+            }
+        }
+    }
     const Firebird::FbException* cause() const { return _cause; }
 
+    /// <summary>
+    /// Error codes of the status vector (isc_xxx constants), the primary one first
+    /// </summary>
+    std::vector<ISC_STATUS> const& codes() const { return _codes; }
+
+    bool has(ISC_STATUS code) const
+    {
+        return std::find(_codes.begin(), _codes.end(), code) != _codes.end();
+    }
+
 private:
     const Firebird::FbException* _cause;
+    std::vector<ISC_STATUS> _codes;
 };
 
 class logic_error : public error
@@ -100,6 +155,74 @@ public:
     {}
 };
 
+class deadline_error : public error
+{
+public:
+    deadline_error(const char* msg)
+        : error(msg)
+    {}
+};
+
+
+/// <summary>
+/// Point in time when an operation must be finished, default one never expires
+/// </summary>
+class deadline
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    deadline() noexcept
+        : m_at{ clock::time_point::max() }
+    {}
+
+    deadline(clock::time_point at) noexcept
+        : m_at{ at }
+    {}
+
+    template <typename Rep, typename Period>
+    static deadline after(std::chrono::duration<Rep, Period> budget)
+    {
+        return { clock::now() + std::chrono::duration_cast<clock::duration>(budget) };
+    }
+
+    static deadline never()
+    {
+        return {};
+    }
+
+    static deadline earliest(deadline const& a, deadline const& b)
+    {
+        return a.m_at < b.m_at ? a : b;
+    }
+
+    bool is_set() const
+    {
+        return m_at != clock::time_point::max();
+    }
+
+    bool expired() const
+    {
+        return is_set() && m_at <= clock::now();
+    }
+
+    clock::duration remaining() const
+    {
+        if (!is_set())
+            return clock::duration::max();
+        auto now = clock::now();
+        return m_at > now ? m_at - now : clock::duration::zero();
+    }
+
+    clock::time_point time_point() const
+    {
+        return m_at;
+    }
+
+private:
+    clock::time_point m_at;
+};
+
 #define CATCH_SQL                                                           \
     catch (const Firebird::FbException& ex) {                               \
         char buf[FBSQLXX_EXCEPTION_BUFFER_SIZE];                            \
@@ -122,8 +245,202 @@ static inline Firebird::IUtil* util()
     return _util;
 }
 
+// every thread gets its own status object, so one attachment may be shared by many threads
+class thread_status
+{
+public:
+    thread_status() : m_wrapper{ master()->getStatus() }
+    {}
+    ~thread_status()
+    {
+        m_wrapper.dispose();
+    }
+    thread_status(const thread_status&) = delete;
+    thread_status& operator=(const thread_status&) = delete;
+
+    Firebird::ThrowStatusWrapper& get() { return m_wrapper; }
+
+private:
+    Firebird::ThrowStatusWrapper m_wrapper;
+};
+
+static inline Firebird::ThrowStatusWrapper& status()
+{
+    thread_local thread_status _status;
+    return _status.get();
+}
+
+// CATCH_SQL for companion headers, the macro is local to this one
+[[noreturn]] static inline void throw_sql_error(const Firebird::FbException& ex)
+{
+    char buf[FBSQLXX_EXCEPTION_BUFFER_SIZE];
+    util()->formatStatus(buf, sizeof(buf), ex.getStatus());
+    throw sql_error{ buf, &ex };
+}
+
+static inline deadline& scoped_deadline()
+{
+    thread_local deadline _deadline;
+    return _deadline;
+}
+
+// the earliest of an own deadline of an entity and the scoped one
+static inline deadline effective(deadline const& own)
+{
+    return deadline::earliest(own, scoped_deadline());
+}
+
+static inline std::pmr::memory_resource*& scoped_resource()
+{
+    thread_local std::pmr::memory_resource* _resource{};
+    return _resource;
+}
+
+// an own memory resource of an entity, else the scoped one, else the default one
+static inline std::pmr::memory_resource* effective(std::pmr::memory_resource* own)
+{
+    if (own)
+        return own;
+    if (auto scoped = scoped_resource())
+        return scoped;
+    return std::pmr::get_default_resource();
+}
+
+static inline void check(deadline const& d, const char* what)
+{
+    if (d.expired())
+        throw deadline_error(what);
+}
+
+// remaining budget in whole units, rounded up, at least one
+template <typename Unit>
+static inline unsigned remaining(deadline const& d)
+{
+    auto left = std::chrono::ceil<Unit>(d.remaining()).count();
+    if (left < 1)
+        return 1;
+    if (left > static_cast<decltype(left)>(std::numeric_limits<int>::max()))
+        return std::numeric_limits<int>::max();
+    return static_cast<unsigned>(left);
+}
+
+// detects simultaneous use of a single-threaded entity (statement, result_set, blob)
+class usage_guard
+{
+public:
+    class scope
+    {
+    public:
+        scope(const usage_guard* guard, const char* what)
+#if FBSQLXX_CHECK_CONCURRENT_USE
+            : m_guard{ guard }
+        {
+            if (m_guard->m_busy.test_and_set(std::memory_order_acquire))
+                throw logic_error(what);
+        }
+        ~scope()
+        {
+            m_guard->m_busy.clear(std::memory_order_release);
+        }
+#else
+        {}
+#endif
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+#if FBSQLXX_CHECK_CONCURRENT_USE
+    private:
+        const usage_guard* m_guard;
+#endif
+    };
+
+    usage_guard() noexcept = default;
+    usage_guard(const usage_guard&) noexcept {} // a new owner starts idle
+
+    usage_guard& operator=(const usage_guard&) noexcept { return *this; }
+
+    scope enter(const char* what) const
+    {
+        return scope{ this, what };
+    }
+
+#if FBSQLXX_CHECK_CONCURRENT_USE
+private:
+    mutable std::atomic_flag m_busy = ATOMIC_FLAG_INIT;
+#endif
+};
+
 } // namespace _detail
 
+
+/// <summary>
+/// Limits all database calls of the current thread within its lifetime by a deadline. The deadline is
+/// mapped to connect, lock wait and statement timeouts, calls made after it has passed throw deadline_error.
+/// Nested scopes can only shorten the budget.
+/// </summary>
+class deadline_scope final
+{
+public:
+    explicit deadline_scope(deadline d)
+        : m_previous{ _detail::scoped_deadline() }
+    {
+        _detail::scoped_deadline() = deadline::earliest(m_previous, d);
+    }
+
+    template <typename Rep, typename Period>
+    explicit deadline_scope(std::chrono::duration<Rep, Period> budget)
+        : deadline_scope{ deadline::after(budget) }
+    {}
+
+    ~deadline_scope()
+    {
+        _detail::scoped_deadline() = m_previous;
+    }
+
+    deadline_scope(deadline_scope const&) = delete;
+    deadline_scope& operator=(deadline_scope const&) = delete;
+
+    static deadline current()
+    {
+        return _detail::scoped_deadline();
+    }
+
+private:
+    deadline m_previous;
+};
+
+/// <summary>
+/// Takes buffers of result sets, row tables and statement parameters made by the current thread within
+/// its lifetime from a memory resource, e.g. a per-request std::pmr::monotonic_buffer_resource.
+/// A resource set on a connection, transaction or statement takes precedence. Objects made in the scope
+/// must not outlive the resource.
+/// </summary>
+class memory_scope final
+{
+public:
+    explicit memory_scope(std::pmr::memory_resource* resource)
+        : m_previous{ _detail::scoped_resource() }
+    {
+        _detail::scoped_resource() = resource;
+    }
+
+    ~memory_scope()
+    {
+        _detail::scoped_resource() = m_previous;
+    }
+
+    memory_scope(memory_scope const&) = delete;
+    memory_scope& operator=(memory_scope const&) = delete;
+
+    static std::pmr::memory_resource* current()
+    {
+        return _detail::effective(nullptr);
+    }
+
+private:
+    std::pmr::memory_resource* m_previous;
+};
+
 inline std::string type_name(unsigned int type)
 {
     switch (type)
@@ -224,9 +541,10 @@ public:
 
     void close()
     {
+        auto busy = m_guard.enter("fbsqlxx::blob is used by several threads at once");
         try
         {
-            m_blob->close(&m_status);
+            m_blob->close(&_detail::status());
             m_blob = nullptr;
         }
         CATCH_SQL
@@ -234,12 +552,13 @@ public:
 
     int64_t info(unsigned char item)
     {
+        auto busy = m_guard.enter("fbsqlxx::blob is used by several threads at once");
         try
         {
             unsigned char items[] = { 0, isc_info_end };
             unsigned char buffer[16];
             items[0] = item;
-            m_blob->getInfo(&m_status, sizeof(items), items, sizeof(buffer), buffer);
+            m_blob->getInfo(&_detail::status(), sizeof(items), items, sizeof(buffer), buffer);
             short length = isc_portable_integer(buffer + 1, 2);
             return isc_portable_integer(buffer + 3, length);
         }
@@ -268,11 +587,13 @@ public:
 
     octets get(unsigned int length)
     {
+        auto busy = m_guard.enter("fbsqlxx::blob is used by several threads at once");
+        check_deadline();
         octets buffer(length);
         try
         {
             unsigned segment_length{};
-            int rc = m_blob->getSegment(&m_status, length, buffer.data(), &segment_length);
+            int rc = m_blob->getSegment(&_detail::status(), length, buffer.data(), &segment_length);
             if (buffer.size() > segment_length)
                 buffer.resize(segment_length);
             return buffer;
@@ -282,6 +603,7 @@ public:
 
     octets get()
     {
+        auto busy = m_guard.enter("fbsqlxx::blob is used by several threads at once");
         using namespace Firebird;
         const unsigned length = MAX_SEGMENT_SIZE;
         octets buffer(length);
@@ -290,8 +612,9 @@ public:
         {
             for (;;)
             {
+                check_deadline();
                 unsigned segment_length{};
-                int rc = m_blob->getSegment(&m_status, length, buffer.data(), &segment_length);
+                int rc = m_blob->getSegment(&_detail::status(), length, buffer.data(), &segment_length);
                 if (rc != IStatus::RESULT_OK && rc != IStatus::RESULT_SEGMENT)
                     break;
                 // stackoverflow says this is the best vector append
@@ -311,18 +634,21 @@ public:
 
     blob& put(const void* buffer, unsigned length)
     {
+        auto busy = m_guard.enter("fbsqlxx::blob is used by several threads at once");
+        check_deadline();
         try
         {
             if (length <= MAX_SEGMENT_SIZE)
-                m_blob->putSegment(&m_status, length, buffer);
+                m_blob->putSegment(&_detail::status(), length, buffer);
             else
             {
                 unsigned pos = 0;
                 const unsigned char* ptr = static_cast<const unsigned char*>(buffer);
                 while (pos < length)
                 {
+                    check_deadline();
                     unsigned len = std::min(MAX_SEGMENT_SIZE, length - pos);
-                    m_blob->putSegment(&m_status, len, ptr + pos);
+                    m_blob->putSegment(&_detail::status(), len, ptr + pos);
                     pos += len;
                 }
             }
@@ -339,18 +665,21 @@ public:
 
     blob& put_string(std::string const& buffer)
     {
+        auto busy = m_guard.enter("fbsqlxx::blob is used by several threads at once");
+        check_deadline();
         try
         {
             if (buffer.size() <= MAX_SEGMENT_SIZE)
-                m_blob->putSegment(&m_status, static_cast<unsigned>(buffer.size()), buffer.data());
+                m_blob->putSegment(&_detail::status(), static_cast<unsigned>(buffer.size()), buffer.data());
             else
             {
                 unsigned pos = 0;
                 const unsigned size = static_cast<unsigned>(buffer.size());
                 while (pos < size)
                 {
+                    check_deadline();
                     unsigned length = std::min(MAX_SEGMENT_SIZE, size - pos);
-                    m_blob->putSegment(&m_status, length, buffer.data() + pos);
+                    m_blob->putSegment(&_detail::status(), length, buffer.data() + pos);
                     pos += length;
                 }
             }
@@ -361,18 +690,21 @@ public:
 
     blob& put_string(const char* buffer)
     {
+        auto busy = m_guard.enter("fbsqlxx::blob is used by several threads at once");
+        check_deadline();
         auto str_length = static_cast<unsigned>(strlen(buffer));
         try
         {
             if (str_length <= MAX_SEGMENT_SIZE)
-                m_blob->putSegment(&m_status, str_length, buffer);
+                m_blob->putSegment(&_detail::status(), str_length, buffer);
             else
             {
                 unsigned pos = 0;
                 while (pos < str_length)
                 {
+                    check_deadline();
                     unsigned length = std::min(MAX_SEGMENT_SIZE, str_length - pos);
-                    m_blob->putSegment(&m_status, length, buffer + pos);
+                    m_blob->putSegment(&_detail::status(), length, buffer + pos);
                     pos += length;
                 }
             }
@@ -383,22 +715,28 @@ public:
 
 private:
     friend class transaction;
-    blob(Firebird::IAttachment* att, Firebird::ITransaction* tra, Firebird::ThrowStatusWrapper& status)
-        : m_status{ status }, m_blob{}, m_id{}
+    blob(Firebird::IAttachment* att, Firebird::ITransaction* tra, deadline const& d)
+        : m_blob{}, m_id{}, m_deadline{ d }
+    {
+        m_blob = att->createBlob(&_detail::status(), tra, &m_id, 0, NULL);
+    }
+
+    blob(Firebird::IAttachment* att, Firebird::ITransaction* tra, ISC_QUAD& id, deadline const& d)
+        : m_blob{}, m_id{ id }, m_deadline{ d }
     {
-        m_blob = att->createBlob(&m_status, tra, &m_id, 0, NULL);
+        m_blob = att->openBlob(&_detail::status(), tra, &m_id, 0, NULL);
     }
 
-    blob(Firebird::IAttachment* att, Firebird::ITransaction* tra, Firebird::ThrowStatusWrapper& status, ISC_QUAD& id)
-        : m_status{ status }, m_blob{}, m_id{ id }
+    void check_deadline() const
     {
-        m_blob = att->openBlob(&m_status, tra, &m_id, 0, NULL);
+        _detail::check(_detail::effective(m_deadline), "fbsqlxx::blob - deadline exceeded");
     }
 
 private:
-    Firebird::ThrowStatusWrapper& m_status;
     Firebird::IBlob* m_blob;
     ISC_QUAD m_id;
+    deadline m_deadline;
+    _detail::usage_guard m_guard;
 };
 
 
@@ -491,6 +829,12 @@ class input_params
 public:
     static constexpr unsigned MY_SQL_OCTETS = 10000001;
 
+    input_params() = default;
+
+    explicit input_params(std::pmr::memory_resource* resource)
+        : params{ resource }
+    {}
+
     bool empty() const
     {
         return params.empty();
@@ -657,8 +1001,8 @@ public:
         return *((T*)offset);
     }
 
-    template <typename Status>
-    Firebird::IMessageMetadata* make_input(std::vector<unsigned char>& buffer, Status& status) const
+    template <typename Buffer, typename Status>
+    Firebird::IMessageMetadata* make_input(Buffer& buffer, Status& status) const
     {
         using namespace Firebird;
 
@@ -699,16 +1043,126 @@ public:
 
         auto imeta = builder->getMetadata(&status);
         buffer.resize(imeta->getMessageLength(&status));
+        write(imeta, buffer.data(), status);
+        return imeta;
+    }
+
+    /// <summary>
+    /// One message layout for many rows: every column takes the type of its first non-null value,
+    /// all-null columns and text take the statement's declared type
+    /// </summary>
+    /// <param name="rows">- rows of the same column types</param>
+    /// <param name="declared">- input metadata of the statement</param>
+    /// <param name="buffer">- receives the messages, one per row, each aligned</param>
+    template <typename Rows, typename Buffer, typename Status>
+    static Firebird::IMessageMetadata* make_batch_input(Rows const& rows,
+        Firebird::IMessageMetadata* declared, Buffer& buffer, Status& status)
+    {
+        using namespace Firebird;
 
+        auto count = declared->getCount(&status);
+        auto builder = make_autodestroy(master()->getMetadataBuilder(&status, count));
         for (unsigned i = 0; i < count; ++i)
         {
-            unsigned char* offset = &buffer[imeta->getOffset(&status, i)];
-            short* null = (short*)&buffer[imeta->getNullOffset(&status, i)];
+            int type = SQL_NULL;
+            for (auto const& row : rows)
+            {
+                if (row.params.size() != count)
+                    throw logic_error("fbsqlxx::input_params - wrong number of parameters in a batch row");
+                if (row.params[i].type != SQL_NULL)
+                {
+                    type = row.params[i].type;
+                    break;
+                }
+            }
+
+            auto declared_type = declared->getType(&status, i) & ~1u;
+            bool declared_text = declared_type == SQL_TEXT || declared_type == SQL_VARYING;
+            if ((type == SQL_TEXT || type == MY_SQL_OCTETS) && !declared_text)
+            {
+                // text converted by the server, e.g. to a number or a date
+                size_t length = 1;
+                for (auto const& row : rows)
+                {
+                    auto const& p = row.params[i];
+                    length = std::max(length, p.type == SQL_TEXT ? p.str_value.size() : p.octets_value.size());
+                }
+                builder->setType(&status, i, SQL_VARYING + 1);
+                builder->setLength(&status, i, static_cast<unsigned>(length));
+            }
+            else if (type == SQL_NULL || type == SQL_TEXT || type == MY_SQL_OCTETS)
+            {
+                builder->setType(&status, i, declared->getType(&status, i) | 1);
+                builder->setSubType(&status, i, declared->getSubType(&status, i));
+                builder->setLength(&status, i, declared->getLength(&status, i));
+                builder->setCharSet(&status, i, declared->getCharSet(&status, i));
+                builder->setScale(&status, i, declared->getScale(&status, i));
+            }
+            else
+            {
+                builder->setType(&status, i, type + 1);
+                if (type == SQL_BLOB)
+                    builder->setSubType(&status, i, declared->getSubType(&status, i));
+            }
+        }
+
+        auto imeta = builder->getMetadata(&status);
+        try
+        {
+            auto length = imeta->getAlignedLength(&status);
+            buffer.assign(length * rows.size(), 0);
+            for (size_t r = 0; r < rows.size(); ++r)
+                rows[r].write(imeta, &buffer[r * length], status);
+        }
+        catch (...)
+        {
+            imeta->release();
+            throw;
+        }
+        return imeta;
+    }
+
+private:
+    template <typename Status>
+    void write(Firebird::IMessageMetadata* imeta, unsigned char* message, Status& status) const
+    {
+        for (unsigned i = 0; i < static_cast<unsigned>(params.size()); ++i)
+        {
+            unsigned char* offset = &message[imeta->getOffset(&status, i)];
+            short* null = (short*)&message[imeta->getNullOffset(&status, i)];
             auto const& param = params[i];
+            auto type = imeta->getType(&status, i) & ~1u;
             auto len = imeta->getLength(&status, i);
 
             *null = (param.type == SQL_NULL) ? -1 : 0;
 
+            // every row of a batch must use the types of the message, text goes to any text column
+            if (param.type != SQL_NULL && param.type != SQL_TEXT && param.type != MY_SQL_OCTETS
+                && type != static_cast<unsigned>(param.type))
+            {
+                throw logic_error("fbsqlxx::input_params - parameter type differs from the previous rows");
+            }
+
+            if (param.type == SQL_TEXT || param.type == MY_SQL_OCTETS)
+            {
+                auto data = param.type == SQL_TEXT ? (const void*)param.str_value.data() : (const void*)param.octets_value.data();
+                auto size = param.type == SQL_TEXT ? param.str_value.size() : param.octets_value.size();
+                if (type == SQL_VARYING && size <= len)
+                {
+                    cast<short>(offset) = static_cast<short>(size);
+                    memcpy(offset + sizeof(short), data, size);
+                }
+                else if (type == SQL_TEXT && size <= len)
+                {
+                    // CHAR(n) of a batch is padded like the server does it
+                    memcpy(offset, data, size);
+                    memset(offset + size, param.type == SQL_TEXT ? ' ' : 0, len - size);
+                }
+                else
+                    throw logic_error("fbsqlxx::input_params - text value does not fit the parameter");
+                continue;
+            }
+
             switch (param.type)
             {
             case SQL_BOOLEAN:
@@ -771,19 +1225,11 @@ public:
                 cast<ISC_TIMESTAMP_TZ>(offset) = param.timestamp_tz_value;
                 break;
 
-            case SQL_TEXT:
-                memcpy(((void*)offset), param.str_value.data(), param.str_value.size());
-                break;
-
             case SQL_VARYING:
                 cast<short>(offset) = static_cast<short>(param.str_value.size());
                 memcpy(offset + 2, param.str_value.data(), param.str_value.size());
                 break;
 
-            case MY_SQL_OCTETS:
-                memcpy(((void*)offset), param.octets_value.data(), param.octets_value.size());
-                break;
-
             case SQL_NULL:
                 break;
 
@@ -795,12 +1241,10 @@ public:
             }
             } // switch
         } // for loop
-
-        return imeta;
     }
 
 private:
-    std::vector<iparam> params;
+    std::pmr::vector<iparam> params;
 };
 
 class executor;
@@ -818,42 +1262,42 @@ class field final
 public:
     std::string name() const
     {
-        return m_meta->getField(&m_status, m_index);
+        return m_meta->getField(&_detail::status(), m_index);
     }
 
     std::string alias() const
     {
-        return m_meta->getAlias(&m_status, m_index);
+        return m_meta->getAlias(&_detail::status(), m_index);
     }
 
     unsigned int charset() const
     {
-        return m_meta->getCharSet(&m_status, m_index);
+        return m_meta->getCharSet(&_detail::status(), m_index);
     }
 
     std::pair<unsigned, int> type() const
     {
-        return { m_meta->getType(&m_status, m_index) & ~1u, m_meta->getSubType(&m_status, m_index) };
+        return { m_meta->getType(&_detail::status(), m_index) & ~1u, m_meta->getSubType(&_detail::status(), m_index) };
     }
 
     bool is_nullable() const
     {
-        return m_meta->isNullable(&m_status, m_index);
+        return m_meta->isNullable(&_detail::status(), m_index);
     }
 
     bool is_null() const
     {
-        return *((short*)&m_buffer[m_meta->getNullOffset(&m_status, m_index)]);
+        return *((short*)&m_buffer[m_meta->getNullOffset(&_detail::status(), m_index)]);
     }
 
     int scale() const
     {
-        return m_meta->getScale(&m_status, m_index);
+        return m_meta->getScale(&_detail::status(), m_index);
     }
 
     unsigned int length() const
     {
-        return m_meta->getLength(&m_status, m_index);
+        return m_meta->getLength(&_detail::status(), m_index);
     }
 
     template <typename T>
@@ -864,11 +1308,13 @@ public:
 
 private:
     friend class result_set;
-    field(unsigned int index, Firebird::IMessageMetadata* meta, Firebird::ThrowStatusWrapper& status, unsigned char* buffer) noexcept
-        : m_index{ index }, m_meta{ meta }, m_status{ status }, m_buffer{ buffer }
+    friend class row;
+    field(unsigned int index, Firebird::IMessageMetadata* meta, unsigned char* buffer,
+        std::pmr::memory_resource* resource = nullptr) noexcept
+        : m_index{ index }, m_meta{ meta }, m_buffer{ buffer }, m_resource{ resource }
     {
-        m_offset = m_meta->getOffset(&m_status, m_index);
-        m_type = m_meta->getType(&m_status, m_index) & ~1u;
+        m_offset = m_meta->getOffset(&_detail::status(), m_index);
+        m_type = m_meta->getType(&_detail::status(), m_index) & ~1u;
     }
 
     template <typename T>
@@ -880,7 +1326,7 @@ private:
     template <typename T>
     float cvt_float(T&& value)
     {
-        int scale = m_meta->getScale(&m_status, m_index);
+        int scale = m_meta->getScale(&_detail::status(), m_index);
         if (scale != 0)
             return static_cast<float>(value) / std::powf(10.0f, static_cast<float>(-scale));
         else
@@ -890,7 +1336,7 @@ private:
     template <typename T>
     double cvt_double(T&& value)
     {
-        int scale = m_meta->getScale(&m_status, m_index);
+        int scale = m_meta->getScale(&_detail::status(), m_index);
         if (scale != 0)
             return static_cast<double>(value) / std::pow(10.0, -scale);
         else
@@ -911,8 +1357,8 @@ private:
 private:
     unsigned int m_index;
     Firebird::IMessageMetadata* m_meta;
-    Firebird::ThrowStatusWrapper& m_status;
     unsigned char* m_buffer;
+    std::pmr::memory_resource* m_resource;  // of the result set, the effective one when not set
     unsigned int m_offset;
     unsigned int m_type;
 };
@@ -1218,7 +1664,7 @@ inline std::string field::as()
     case SQL_TEXT:
     {
         const char* from = (const char*)&m_buffer[m_offset];
-        const char* to = from + m_meta->getLength(&m_status, m_index);
+        const char* to = from + m_meta->getLength(&_detail::status(), m_index);
         return std::string{ from, to };
     }
     } // switch
@@ -1237,64 +1683,524 @@ inline octets field::as()
         return octets{ from, to };
     }
     const unsigned char* from = (const unsigned char*)&m_buffer[m_offset];
-    const unsigned char* to = from + m_meta->getLength(&m_status, m_index);
+    const unsigned char* to = from + m_meta->getLength(&_detail::status(), m_index);
     return octets{ from, to };
 }
 
+template <>
+inline std::pmr::string field::as()
+{
+    auto resource = _detail::effective(m_resource);
+    switch (m_type)
+    {
+    case SQL_VARYING:
+    {
+        short length = cast<short>();
+        const char* from = (const char*)&m_buffer[m_offset + sizeof(short)];
+        return std::pmr::string{ from, from + length, resource };
+    }
+    case SQL_TEXT:
+    {
+        const char* from = (const char*)&m_buffer[m_offset];
+        const char* to = from + m_meta->getLength(&_detail::status(), m_index);
+        return std::pmr::string{ from, to, resource };
+    }
+    } // switch
+
+    INVALID_CONVERSION(m_type, "TEXT");
+}
+
+template <>
+inline std::pmr::vector<unsigned char> field::as()
+{
+    auto resource = _detail::effective(m_resource);
+    const unsigned char* from = (const unsigned char*)&m_buffer[m_offset];
+    const unsigned char* to = from + m_meta->getLength(&_detail::status(), m_index);
+    if (m_type == SQL_VARYING)
+    {
+        from += sizeof(short);
+        to = from + cast<short>();
+    }
+    return std::pmr::vector<unsigned char>{ from, to, resource };
+}
+
 #undef CHECK_TYPE
 #undef INVALID_CONVERSION
 
 
-class result_set final
+// not owns any other entities, valid as long as the message buffer and metadata it refers to
+class row final
 {
 public:
-    result_set(result_set const&) = delete;
-    result_set& operator=(result_set const&) = delete;
-    result_set& operator=(result_set&&) = delete;
+    row(Firebird::IMessageMetadata* meta, const unsigned char* buffer)
+        : m_meta{ meta }, m_buffer{ buffer }
+    {}
 
-    result_set(result_set&& rhs) noexcept
-        : m_rs{ rhs.m_rs }
-        , m_meta{ rhs.m_meta }
-        , m_status{ rhs.m_status }
-        , m_buffer{ rhs.m_buffer }
-        , m_count{ rhs.m_count }
+    unsigned int ncols() const
     {
-        rhs.m_rs = nullptr;
-        rhs.m_meta = nullptr;
-        rhs.m_buffer = nullptr;
+        return m_meta->getCount(&_detail::status());
     }
 
-    ~result_set()
+    field get(unsigned int index) const
     {
-        delete[] m_buffer;
-        if (m_meta)
-            m_meta->release();
-        if (m_rs)
-            m_rs->release();
+        if (index >= ncols())
+        {
+            throw logic_error("Row index out of bounds");
+        }
+
+        return field{ index, m_meta, const_cast<unsigned char*>(m_buffer) };
     }
 
-    void close()
+    /// <summary>
+    /// Raw row message, its layout is described by metadata()
+    /// </summary>
+    const unsigned char* data() const
     {
-        delete[] m_buffer;
+        return m_buffer;
+    }
+
+    unsigned int length() const
+    {
+        return m_meta->getMessageLength(&_detail::status());
+    }
+
+    Firebird::IMessageMetadata* metadata() const
+    {
+        return m_meta;
+    }
+
+private:
+    Firebird::IMessageMetadata* m_meta;
+    const unsigned char* m_buffer;
+};
+
+
+/// <summary>
+/// Rows of a result set held in memory, see result_set::materialize(). Row messages are copied as fetched,
+/// variable-length values stay in place, into large blocks allocated one after another and freed together.
+/// Rows are valid as long as the table.
+/// </summary>
+class row_table final
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = row;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = row;
+
+        row operator*() const
+        {
+            return (*m_table)[m_index];
+        }
+
+        iterator& operator++()
+        {
+            ++m_index;
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            auto res = *this;
+            ++m_index;
+            return res;
+        }
+
+        bool operator==(iterator const& rhs) const
+        {
+            return m_index == rhs.m_index;
+        }
+
+        bool operator!=(iterator const& rhs) const
+        {
+            return m_index != rhs.m_index;
+        }
+
+    private:
+        friend class row_table;
+        iterator(row_table const* table, size_t index)
+            : m_table{ table }, m_index{ index }
+        {}
+
+        row_table const* m_table;
+        size_t m_index;
+    };
+
+    row_table() = default;
+
+    /// <summary>
+    /// Rows kept in memory owned by someone else, e.g. a mapped file; rows appended later go to own blocks
+    /// </summary>
+    /// <param name="meta">- row format</param>
+    /// <param name="rows">- row messages one after another at the aligned message length</param>
+    /// <param name="count">- number of rows</param>
+    /// <param name="storage">- keeps the memory of the rows alive as long as the table</param>
+    row_table(Firebird::IMessageMetadata* meta, const unsigned char* rows, size_t count, std::shared_ptr<const void> storage)
+        : row_table{ meta, _detail::effective(nullptr) }
+    {
+        m_storage = std::move(storage);
+        m_base = rows;
+        m_base_rows = count;
+        m_size = count;
+    }
+
+    row_table(row_table const&) = delete;
+    row_table& operator=(row_table const&) = delete;
+
+    row_table(row_table&& rhs) noexcept
+        : m_meta{ rhs.m_meta }
+        , m_resource{ rhs.m_resource }
+        , m_blocks{ std::move(rhs.m_blocks) }
+        , m_storage{ std::move(rhs.m_storage) }
+        , m_base{ rhs.m_base }
+        , m_base_rows{ rhs.m_base_rows }
+        , m_stride{ rhs.m_stride }
+        , m_block_rows{ rhs.m_block_rows }
+        , m_size{ rhs.m_size }
+    {
+        rhs.m_meta = nullptr;
+        rhs.m_base = nullptr;
+        rhs.m_base_rows = 0;
+        rhs.m_size = 0;
+    }
+
+    row_table& operator=(row_table&& rhs) noexcept
+    {
+        std::swap(m_meta, rhs.m_meta);
+        std::swap(m_resource, rhs.m_resource);
+        std::swap(m_blocks, rhs.m_blocks);
+        std::swap(m_storage, rhs.m_storage);
+        std::swap(m_base, rhs.m_base);
+        std::swap(m_base_rows, rhs.m_base_rows);
+        std::swap(m_stride, rhs.m_stride);
+        std::swap(m_block_rows, rhs.m_block_rows);
+        std::swap(m_size, rhs.m_size);
+        return *this;
+    }
+
+    ~row_table()
+    {
+        for (auto b : m_blocks)
+            m_resource->deallocate(b, m_block_rows * m_stride, alignof(std::max_align_t));
+        if (m_meta)
+            m_meta->release();
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    unsigned int ncols() const
+    {
+        return m_meta ? m_meta->getCount(&_detail::status()) : 0;
+    }
+
+    /// <summary>
+    /// Row by index, not checked
+    /// </summary>
+    row operator[](size_t index) const
+    {
+        if (index < m_base_rows)
+            return row{ m_meta, m_base + index * m_stride };
+        index -= m_base_rows;
+        return row{ m_meta, m_blocks[index / m_block_rows] + (index % m_block_rows) * m_stride };
+    }
+
+    row at(size_t index) const
+    {
+        if (index >= m_size)
+        {
+            throw logic_error("Row index out of bounds");
+        }
+
+        return (*this)[index];
+    }
+
+    iterator begin() const
+    {
+        return iterator{ this, 0 };
+    }
+
+    iterator end() const
+    {
+        return iterator{ this, m_size };
+    }
+
+    Firebird::IMessageMetadata* metadata() const
+    {
+        return m_meta;
+    }
+
+    /// <summary>
+    /// Append a copy of a row of the same format, see same_format(), not checked
+    /// </summary>
+    void push_back(row const& r)
+    {
+        memcpy(append(), r.data(), r.length());
+    }
+
+    /// <summary>
+    /// Rows of this format can be appended, the columns have the same types and places in the message
+    /// </summary>
+    bool same_format(Firebird::IMessageMetadata* meta) const
+    {
+        auto& status = _detail::status();
+        auto count = meta->getCount(&status);
+        if (!m_meta || count != m_meta->getCount(&status) || meta->getMessageLength(&status) != m_meta->getMessageLength(&status))
+            return false;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if ((meta->getType(&status, i) & ~1u) != (m_meta->getType(&status, i) & ~1u)
+                || meta->getLength(&status, i) != m_meta->getLength(&status, i)
+                || meta->getScale(&status, i) != m_meta->getScale(&status, i)
+                || meta->getOffset(&status, i) != m_meta->getOffset(&status, i)
+                || meta->getNullOffset(&status, i) != m_meta->getNullOffset(&status, i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    friend class result_set;
+    row_table(Firebird::IMessageMetadata* meta, std::pmr::memory_resource* resource)
+        : m_meta{ meta }
+        , m_resource{ resource }
+    {
+        m_meta->addRef();
+        m_stride = m_meta->getAlignedLength(&_detail::status());
+        m_block_rows = std::max<size_t>(1, FBSQLXX_ROW_TABLE_BLOCK_SIZE / std::max(m_stride, 1u));
+    }
+
+    // room for the next row message
+    unsigned char* append()
+    {
+        auto own = m_size - m_base_rows;
+        auto pos = own % m_block_rows;
+        if (pos == 0 && own / m_block_rows == m_blocks.size())
+        {
+            // room first, so push_back can not throw and leak the block
+            if (m_blocks.size() == m_blocks.capacity())
+                m_blocks.reserve(std::max<size_t>(2 * m_blocks.capacity(), 16));
+            m_blocks.push_back(static_cast<unsigned char*>(m_resource->allocate(m_block_rows * m_stride, alignof(std::max_align_t))));
+        }
+        ++m_size;
+        return m_blocks[own / m_block_rows] + pos * m_stride;
+    }
+
+private:
+    Firebird::IMessageMetadata* m_meta{};
+    std::pmr::memory_resource* m_resource{ std::pmr::get_default_resource() };
+    std::vector<unsigned char*> m_blocks;     // allocated from m_resource
+    std::shared_ptr<const void> m_storage;  // owner of the rows not in blocks
+    const unsigned char* m_base{};
+    size_t m_base_rows{};
+    unsigned int m_stride{};            // aligned message length
+    size_t m_block_rows{ 1 };
+    size_t m_size{};
+};
+
+
+namespace _detail {
+
+// location and type of a column within row messages, to compare values without metadata calls
+struct key_part
+{
+    unsigned type;
+    int scale;
+    unsigned offset;
+    unsigned null_offset;
+    unsigned length;
+};
+
+static inline key_part make_key_part(Firebird::IMessageMetadata* meta, unsigned index)
+{
+    auto& status = _detail::status();
+    return {
+        meta->getType(&status, index) & ~1u,
+        meta->getScale(&status, index),
+        meta->getOffset(&status, index),
+        meta->getNullOffset(&status, index),
+        meta->getLength(&status, index) };
+}
+
+// value of a message field, which may be unaligned
+template <typename T>
+static inline T load(const unsigned char* data)
+{
+    T res;
+    memcpy(&res, data, sizeof(T));
+    return res;
+}
+
+template <typename T>
+static inline int compare_as(const unsigned char* a, const unsigned char* b)
+{
+    T x, y;
+    memcpy(&x, a, sizeof(T));
+    memcpy(&y, b, sizeof(T));
+    return x < y ? -1 : (y < x ? 1 : 0);
+}
+
+static inline int compare_bytes(const unsigned char* a, unsigned a_length, const unsigned char* b, unsigned b_length)
+{
+    int rc = memcmp(a, b, std::min(a_length, b_length));
+    if (rc != 0)
+        return rc < 0 ? -1 : 1;
+    return a_length < b_length ? -1 : (b_length < a_length ? 1 : 0);
+}
+
+/// compares one column of two row messages, NULL goes first;
+/// text is compared bytewise, which is the server order for binary collations only
+static inline int compare(key_part const& key, const unsigned char* a, const unsigned char* b)
+{
+    bool a_null = *reinterpret_cast<const short*>(a + key.null_offset) != 0;
+    bool b_null = *reinterpret_cast<const short*>(b + key.null_offset) != 0;
+    if (a_null || b_null)
+        return a_null == b_null ? 0 : (a_null ? -1 : 1);
+
+    a += key.offset;
+    b += key.offset;
+    switch (key.type)
+    {
+    case SQL_BOOLEAN:
+        return compare_as<unsigned char>(a, b);
+    case SQL_SHORT:
+        return compare_as<short>(a, b);
+    case SQL_LONG:
+        return compare_as<int32_t>(a, b);
+    case SQL_INT64:
+        return compare_as<int64_t>(a, b);
+    case SQL_INT128:
+    {
+        // little-endian halves, the high one is signed
+        int rc = compare_as<int64_t>(a + sizeof(uint64_t), b + sizeof(uint64_t));
+        return rc != 0 ? rc : compare_as<uint64_t>(a, b);
+    }
+    case SQL_FLOAT:
+        return compare_as<float>(a, b);
+    case SQL_DOUBLE:
+        return compare_as<double>(a, b);
+    case SQL_TYPE_DATE:
+        return compare_as<ISC_DATE>(a, b);
+    case SQL_TYPE_TIME:
+    case SQL_TIME_TZ:
+        return compare_as<ISC_TIME>(a, b);
+    case SQL_TIMESTAMP:
+    case SQL_TIMESTAMP_TZ:
+    {
+        int rc = compare_as<ISC_DATE>(a, b);
+        return rc != 0 ? rc : compare_as<ISC_TIME>(a + sizeof(ISC_DATE), b + sizeof(ISC_DATE));
+    }
+    case SQL_TEXT:
+        return compare_bytes(a, key.length, b, key.length);
+    case SQL_VARYING:
+    {
+        unsigned short a_length, b_length;
+        memcpy(&a_length, a, sizeof(a_length));
+        memcpy(&b_length, b, sizeof(b_length));
+        return compare_bytes(a + sizeof(short), a_length, b + sizeof(short), b_length);
+    }
+    default:
+        break;
+    }
+
+    std::string msg = "Column type is not comparable: ";
+    msg += type_name(key.type);
+    throw logic_error(msg.data());
+}
+
+} // namespace _detail
+
+
+class result_set final
+{
+public:
+    result_set(result_set const&) = delete;
+    result_set& operator=(result_set const&) = delete;
+    result_set& operator=(result_set&&) = delete;
+
+    result_set(result_set&& rhs) noexcept
+        : m_rs{ rhs.m_rs }
+        , m_meta{ rhs.m_meta }
+        , m_buffer{ rhs.m_buffer }
+        , m_length{ rhs.m_length }
+        , m_count{ rhs.m_count }
+        , m_stmt{ rhs.m_stmt }
+        , m_deadline{ rhs.m_deadline }
+        , m_resource{ rhs.m_resource }
+    {
+        rhs.m_rs = nullptr;
+        rhs.m_meta = nullptr;
+        rhs.m_buffer = nullptr;
+        rhs.m_stmt = nullptr;
+    }
+
+    ~result_set()
+    {
+        if (m_buffer)
+            m_resource->deallocate(m_buffer, m_length, alignof(std::max_align_t));
+        if (m_meta)
+            m_meta->release();
+        if (m_rs)
+            m_rs->release();
+        if (m_stmt)
+            m_stmt->release();
+    }
+
+    void close()
+    {
+        auto busy = m_guard.enter("fbsqlxx::result_set is used by several threads at once");
+        m_resource->deallocate(m_buffer, m_length, alignof(std::max_align_t));
         m_buffer = nullptr;
         m_meta->release();
         m_meta = nullptr;
 
         auto temp = m_rs;
         m_rs = nullptr;
+        auto stmt = m_stmt;
+        m_stmt = nullptr;
 
         try
         {
-            temp->close(&m_status);
+            try
+            {
+                temp->close(&_detail::status());
+                temp = nullptr;
+                if (stmt)
+                    stmt->free(&_detail::status());
+            }
+            catch (...)
+            {
+                // failed close and free leave the interfaces to be released
+                if (temp)
+                    temp->release();
+                if (stmt)
+                    stmt->release();
+                throw;
+            }
         }
         CATCH_SQL
     }
 
     bool next()
     {
+        auto busy = m_guard.enter("fbsqlxx::result_set is used by several threads at once");
+        _detail::check(_detail::effective(m_deadline), "fbsqlxx::result_set - deadline exceeded");
         try
         {
-            return m_rs->fetchNext(&m_status, m_buffer) == Firebird::IStatus::RESULT_OK;
+            return m_rs->fetchNext(&_detail::status(), m_buffer) == Firebird::IStatus::RESULT_OK;
         }
         CATCH_SQL
     }
@@ -1309,7 +2215,7 @@ public:
         std::vector<std::string> res;
         for (unsigned int i = 0; i < m_count; ++i)
         {
-            res.emplace_back(m_meta->getField(&m_status, i));
+            res.emplace_back(m_meta->getField(&_detail::status(), i));
         }
         return res;
     }
@@ -1319,7 +2225,7 @@ public:
         std::vector<std::string> res;
         for (unsigned int i = 0; i < m_count; ++i)
         {
-            res.emplace_back(m_meta->getAlias(&m_status, i));
+            res.emplace_back(m_meta->getAlias(&_detail::status(), i));
         }
         return res;
     }
@@ -1329,7 +2235,43 @@ public:
         std::vector<unsigned int> res;
         for (unsigned int i = 0; i < m_count; ++i)
         {
-            res.emplace_back(m_meta->getType(&m_status, i));
+            res.emplace_back(m_meta->getType(&_detail::status(), i));
+        }
+        return res;
+    }
+
+    /// <summary>
+    /// Column names allocated from a memory resource
+    /// </summary>
+    std::pmr::vector<std::pmr::string> names(std::pmr::memory_resource* resource) const
+    {
+        std::pmr::vector<std::pmr::string> res{ resource };
+        res.reserve(m_count);
+        for (unsigned int i = 0; i < m_count; ++i)
+        {
+            res.emplace_back(m_meta->getField(&_detail::status(), i));
+        }
+        return res;
+    }
+
+    std::pmr::vector<std::pmr::string> aliases(std::pmr::memory_resource* resource) const
+    {
+        std::pmr::vector<std::pmr::string> res{ resource };
+        res.reserve(m_count);
+        for (unsigned int i = 0; i < m_count; ++i)
+        {
+            res.emplace_back(m_meta->getAlias(&_detail::status(), i));
+        }
+        return res;
+    }
+
+    std::pmr::vector<unsigned int> types(std::pmr::memory_resource* resource) const
+    {
+        std::pmr::vector<unsigned int> res{ resource };
+        res.reserve(m_count);
+        for (unsigned int i = 0; i < m_count; ++i)
+        {
+            res.emplace_back(m_meta->getType(&_detail::status(), i));
         }
         return res;
     }
@@ -1341,28 +2283,66 @@ public:
             throw logic_error("Row index out of bounds");
         }
 
-        return field{ index, m_meta, m_status, m_buffer };
+        return field{ index, m_meta, m_buffer, m_resource };
+    }
+
+    /// <summary>
+    /// Current row, valid until the next call to next() or close()
+    /// </summary>
+    row current() const
+    {
+        return row{ m_meta, m_buffer };
+    }
+
+    /// <summary>
+    /// Fetch the remaining rows into memory
+    /// </summary>
+    /// <returns>rows in large blocks, a few allocations for the whole result</returns>
+    row_table materialize()
+    {
+        row_table res{ m_meta, m_resource };
+        materialize(res);
+        return res;
+    }
+
+    /// <summary>
+    /// Fetch the remaining rows and append them to a table of the same format
+    /// </summary>
+    void materialize(row_table& table)
+    {
+        if (!table.same_format(m_meta))
+            throw logic_error("fbsqlxx::result_set - row format differs from the table");
+        auto length = m_meta->getMessageLength(&_detail::status());
+        while (next())
+            memcpy(table.append(), m_buffer, length);
     }
 
 
 private:
     friend class _detail::executor;
-    result_set(Firebird::IResultSet* rs, Firebird::IMessageMetadata* meta, Firebird::ThrowStatusWrapper& status)
+    result_set(Firebird::IResultSet* rs, Firebird::IMessageMetadata* meta, deadline const& d,
+        std::pmr::memory_resource* resource, Firebird::IStatement* stmt = nullptr)
         : m_rs{ rs }
         , m_meta{ meta }
-        , m_status{ status }
+        , m_stmt{ stmt }
+        , m_deadline{ d }
+        , m_resource{ resource }
     {
-        auto length = m_meta->getMessageLength(&status);
-        m_buffer = new unsigned char[length];
-        m_count = m_meta->getCount(&m_status);
+        m_length = m_meta->getMessageLength(&_detail::status());
+        m_buffer = static_cast<unsigned char*>(m_resource->allocate(m_length, alignof(std::max_align_t)));
+        m_count = m_meta->getCount(&_detail::status());
     }
 
 private:
     Firebird::IResultSet* m_rs;
     Firebird::IMessageMetadata* m_meta;
-    Firebird::ThrowStatusWrapper& m_status;
     unsigned char* m_buffer{};
+    unsigned int m_length{};
     unsigned int m_count;
+    Firebird::IStatement* m_stmt;   // owned statement of an immediate cursor, if any
+    deadline m_deadline;
+    std::pmr::memory_resource* m_resource;
+    _detail::usage_guard m_guard;
 };
 
 
@@ -1371,70 +2351,102 @@ namespace _detail {
 class executor
 {
 public:
-    static result_set cursor(input_params const& params, Firebird::IStatement* stmt, Firebird::ThrowStatusWrapper& status,
-        Firebird::ITransaction* tra)
+    // statement timeout follows the deadline, a statement used without deadline has no own timeout
+    static void set_timeout(Firebird::IStatement* stmt, Firebird::ThrowStatusWrapper& status, deadline const& d)
+    {
+        if (d.is_set())
+            stmt->setTimeout(&status, remaining<std::chrono::milliseconds>(d));
+        else if (stmt->getTimeout(&status) != 0)
+            stmt->setTimeout(&status, 0);
+    }
+
+    static result_set cursor(input_params const& params, Firebird::IStatement* stmt,
+        Firebird::ITransaction* tra, deadline const& d, std::pmr::memory_resource* mr, bool owns_stmt = false)
     {
         using namespace Firebird;
 
+        auto& status = _detail::status();
         try
         {
+            check(d, "fbsqlxx::statement::cursor() - deadline exceeded");
+            set_timeout(stmt, status, d);
             if (params.empty())
             {
                 IResultSet* rs = stmt->openCursor(&status, tra, NULL, NULL, NULL, 0);
                 auto ometa = stmt->getOutputMetadata(&status);
-                return result_set{ rs, ometa, status };
+                return result_set{ rs, ometa, d, mr, owns_stmt ? stmt : nullptr };
             }
             else
             {
-                std::vector<unsigned char> buffer;
+                std::pmr::vector<unsigned char> buffer{ mr };
                 auto imeta = make_autodestroy(params.make_input(buffer, status));
                 IResultSet* rs = stmt->openCursor(&status, tra, &imeta, buffer.data(), NULL, 0);
                 auto ometa = stmt->getOutputMetadata(&status);
-                return result_set{ rs, ometa, status };
+                return result_set{ rs, ometa, d, mr, owns_stmt ? stmt : nullptr };
             }
         }
         CATCH_SQL
     }
 
-    static result_set cursor(input_params const& params, Firebird::IAttachment* att, Firebird::ThrowStatusWrapper& status,
-        Firebird::ITransaction* tra, const char* sql)
+    static result_set cursor(input_params const& params, Firebird::IAttachment* att,
+        Firebird::ITransaction* tra, const char* sql, deadline const& d, std::pmr::memory_resource* mr)
     {
         using namespace Firebird;
 
+        auto& status = _detail::status();
         try
         {
+            check(d, "fbsqlxx::transaction::cursor() - deadline exceeded");
+            if (d.is_set())
+            {
+                // an attachment has no per-call timeout, the statement carries it
+                IStatement* stmt = att->prepare(&status, tra, 0, sql, SQL_DIALECT_V6, IStatement::PREPARE_PREFETCH_METADATA);
+                try
+                {
+                    return cursor(params, stmt, tra, d, mr, true);
+                }
+                catch (...)
+                {
+                    stmt->release();
+                    throw;
+                }
+            }
+
             if (params.empty())
             {
                 IResultSet* rs = att->openCursor(&status, tra, 0, sql, SQL_DIALECT_V6, NULL, NULL, NULL, NULL, 0);
                 auto ometa = rs->getMetadata(&status);
-                return result_set{ rs, ometa, status };
+                return result_set{ rs, ometa, d, mr };
             }
             else
             {
-                std::vector<unsigned char> buffer;
+                std::pmr::vector<unsigned char> buffer{ mr };
                 auto imeta = make_autodestroy(params.make_input(buffer, status));
                 IResultSet* rs = att->openCursor(&status, tra, 0, sql, SQL_DIALECT_V6, &imeta, buffer.data(), NULL, NULL, 0);
                 auto ometa = rs->getMetadata(&status);
-                return result_set{ rs, ometa, status };
+                return result_set{ rs, ometa, d, mr };
             }
         }
         CATCH_SQL
     }
 
-    static size_t execute(input_params const& params, Firebird::IStatement* stmt, Firebird::ThrowStatusWrapper& status,
-        Firebird::ITransaction* tra)
+    static size_t execute(input_params const& params, Firebird::IStatement* stmt,
+        Firebird::ITransaction* tra, deadline const& d, std::pmr::memory_resource* mr)
     {
         using namespace Firebird;
 
+        auto& status = _detail::status();
         try
         {
+            check(d, "fbsqlxx::statement::execute() - deadline exceeded");
+            set_timeout(stmt, status, d);
             if (params.empty())
             {
                 stmt->execute(&status, tra, NULL, NULL, NULL, NULL);
             }
             else
             {
-                std::vector<unsigned char> buffer;
+                std::pmr::vector<unsigned char> buffer{ mr };
                 auto imeta = make_autodestroy(params.make_input(buffer, status));
                 stmt->execute(&status, tra, &imeta, buffer.data(), NULL, NULL);
             }
@@ -1443,22 +2455,106 @@ public:
         CATCH_SQL
     }
 
-    static void execute(Firebird::IAttachment* att, Firebird::ThrowStatusWrapper& status, Firebird::ITransaction* tra, const char* sql)
+    // all rows in one IBatch round trip, stops at the first failed row
+    static size_t execute_batch(std::pmr::vector<input_params> const& rows, Firebird::IStatement* stmt,
+        Firebird::ITransaction* tra, deadline const& d, std::pmr::memory_resource* mr)
     {
+        using namespace Firebird;
+
+        static const unsigned default_buffer_size = 16 * 1024 * 1024;
+
+        auto& status = _detail::status();
         try
         {
-            att->execute(&status, tra, 0, sql, SQL_DIALECT_V6, NULL, NULL, NULL, NULL);
+            check(d, "fbsqlxx::statement::execute_batch() - deadline exceeded");
+            if (rows.empty())
+                return 0;
+            set_timeout(stmt, status, d);
+
+            std::pmr::vector<unsigned char> buffer{ mr };
+            auto declared = make_autodestroy(stmt->getInputMetadata(&status));
+            auto imeta = make_autodestroy(input_params::make_batch_input(rows, &declared, buffer, status));
+
+            std::vector<unsigned> blobs;
+            for (unsigned i = 0; i < imeta->getCount(&status); ++i)
+                if ((imeta->getType(&status, i) & ~1u) == SQL_BLOB)
+                    blobs.push_back(i);
+
+            auto bpb = make_autodestroy(util()->getXpbBuilder(&status, IXpbBuilder::BATCH, nullptr, 0));
+            bpb->insertInt(&status, IBatch::TAG_RECORD_COUNTS, 1);
+            if (buffer.size() > default_buffer_size)
+                bpb->insertInt(&status, IBatch::TAG_BUFFER_BYTES_SIZE, static_cast<int>(buffer.size()));
+            if (!blobs.empty())
+                bpb->insertInt(&status, IBatch::TAG_BLOB_POLICY, IBatch::BLOB_ID_ENGINE);
+
+            auto batch = make_autodestroy(stmt->createBatch(&status, &imeta, bpb->getBufferLength(&status), bpb->getBuffer(&status)));
+
+            // a batch takes blob ids of its own, existing blobs are registered to get them
+            auto length = imeta->getAlignedLength(&status);
+            for (size_t r = 0; r < rows.size() && !blobs.empty(); ++r)
+            {
+                auto message = &buffer[r * length];
+                for (auto i : blobs)
+                {
+                    if (*reinterpret_cast<short*>(message + imeta->getNullOffset(&status, i)))
+                        continue;
+                    auto id = message + imeta->getOffset(&status, i);
+                    auto existing = load<ISC_QUAD>(id);
+                    ISC_QUAD batch_id{};
+                    batch->registerBlob(&status, &existing, &batch_id);
+                    memcpy(id, &batch_id, sizeof(batch_id));
+                }
+            }
+            batch->add(&status, static_cast<unsigned>(rows.size()), buffer.data());
+            auto state = make_autodestroy(batch->execute(&status, tra));
+
+            auto failed = state->findError(&status, 0);
+            if (failed != IBatchCompletionState::NO_MORE_ERRORS)
+            {
+                auto error = make_autodestroy(master()->getStatus());
+                state->getStatus(&status, &error, failed);
+                throw FbException(&error);
+            }
+
+            size_t res = 0;
+            auto size = state->getSize(&status);
+            for (unsigned i = 0; i < size; ++i)
+            {
+                auto affected = state->getState(&status, i);
+                if (affected > 0)
+                    res += static_cast<size_t>(affected);
+            }
+            return res;
         }
         CATCH_SQL
     }
 
-    static void execute(input_params const& params, Firebird::IAttachment* att, Firebird::ThrowStatusWrapper& status, Firebird::ITransaction* tra, const char* sql)
+    static void execute(input_params const& params, Firebird::IAttachment* att, Firebird::ITransaction* tra, const char* sql,
+        deadline const& d, std::pmr::memory_resource* mr)
     {
+        using namespace Firebird;
+
+        auto& status = _detail::status();
         try
         {
-            std::vector<unsigned char> buffer;
-            auto imeta = make_autodestroy(params.make_input(buffer, status));
-            att->execute(&status, tra, 0, sql, SQL_DIALECT_V6, &imeta, buffer.data(), NULL, NULL);
+            check(d, "fbsqlxx::transaction::execute() - deadline exceeded");
+            if (d.is_set())
+            {
+                auto stmt = make_autodestroy(att->prepare(&status, tra, 0, sql, SQL_DIALECT_V6, IStatement::PREPARE_PREFETCH_METADATA));
+                execute(params, &stmt, tra, d, mr);
+                return;
+            }
+
+            if (params.empty())
+            {
+                att->execute(&status, tra, 0, sql, SQL_DIALECT_V6, NULL, NULL, NULL, NULL);
+            }
+            else
+            {
+                std::pmr::vector<unsigned char> buffer{ mr };
+                auto imeta = make_autodestroy(params.make_input(buffer, status));
+                att->execute(&status, tra, 0, sql, SQL_DIALECT_V6, &imeta, buffer.data(), NULL, NULL);
+            }
         }
         CATCH_SQL
     }
@@ -1475,9 +2571,10 @@ public:
     statement& operator=(statement&&) = delete;
 
     statement(statement&& rhs) noexcept
-        : m_status{ rhs.m_status }
-        , m_tra{ rhs.m_tra }
+        : m_tra{ rhs.m_tra }
         , m_stmt{ rhs.m_stmt }
+        , m_deadline{ rhs.m_deadline }
+        , m_resource{ rhs.m_resource }
         , m_iparams{ std::move(rhs.m_iparams) }
     {
         rhs.m_stmt = nullptr;
@@ -1490,13 +2587,14 @@ public:
 
     void close()
     {
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
         m_iparams.clear();
         auto temp = m_stmt;
         m_stmt = nullptr;
 
         try
         {
-            temp->free(&m_status);
+            temp->free(&_detail::status());
         }
         CATCH_SQL
     }
@@ -1504,53 +2602,118 @@ public:
     template<typename T>
     statement& add(T&& value)
     {
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
         m_iparams.add(std::forward<T>(value));
         return *this;
     }
 
     void clear()
     {
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
         m_iparams.clear();
     }
 
+    /// <summary>
+    /// Execution plan chosen by the optimizer
+    /// </summary>
+    /// <param name="detailed">- explained (tree-like) plan instead of the legacy one-line form</param>
+    /// <returns>plan text, empty when the statement has no plan</returns>
+    std::string plan(bool detailed = false) const
+    {
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+        try
+        {
+            auto text = m_stmt->getPlan(&_detail::status(), detailed);
+            return text ? text : "";
+        }
+        CATCH_SQL
+    }
+
+    /// <summary>
+    /// Execute the prepared statement within another transaction of the same connection
+    /// </summary>
+    /// <param name="tra">- transaction to run the statement in</param>
+    inline statement& rebind(transaction const& tra);
+
+    /// <summary>
+    /// Take buffers of result sets and parameters of this statement from a memory resource
+    /// </summary>
+    /// <param name="resource">- memory resource, outliving the result sets; nullptr for the scoped one</param>
+    statement& use_memory(std::pmr::memory_resource* resource)
+    {
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+        m_resource = resource;
+        return *this;
+    }
+
     result_set cursor() const
     {
-        return _detail::executor::cursor(m_iparams, m_stmt, m_status, m_tra);
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+        return _detail::executor::cursor(m_iparams, m_stmt, m_tra, _detail::effective(m_deadline), _detail::effective(m_resource));
     }
 
     template <typename ...Args>
     result_set cursor(Args&& ...args) const
     {
-        _detail::input_params params;
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+        auto mr = _detail::effective(m_resource);
+        _detail::input_params params{ mr };
         (..., params.add(std::forward<Args>(args)));
-        return _detail::executor::cursor(params, m_stmt, m_status, m_tra);
+        return _detail::executor::cursor(params, m_stmt, m_tra, _detail::effective(m_deadline), mr);
     }
 
     size_t execute() const
     {
-        return _detail::executor::execute(m_iparams, m_stmt, m_status, m_tra);
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+        return _detail::executor::execute(m_iparams, m_stmt, m_tra, _detail::effective(m_deadline), _detail::effective(m_resource));
     }
 
     template <typename ...Args>
     size_t execute(Args&& ...args) const
     {
-        _detail::input_params params;
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+        auto mr = _detail::effective(m_resource);
+        _detail::input_params params{ mr };
         (..., params.add(std::forward<Args>(args)));
-        return _detail::executor::execute(params, m_stmt, m_status, m_tra);
+        return _detail::executor::execute(params, m_stmt, m_tra, _detail::effective(m_deadline), mr);
+    }
+
+    /// <summary>
+    /// Execute the statement once for every row, all rows in one round trip, Firebird 4 and later.
+    /// Text and null values take the types of the statement parameters, other values must keep
+    /// their types from row to row. Blob values are ids of blobs created in the connection, each
+    /// is registered with the batch.
+    /// </summary>
+    /// <param name="rows">- range of <em>std::tuple</em>, an element per parameter</param>
+    /// <returns>number of affected records</returns>
+    template <typename Rows>
+    size_t execute_batch(Rows const& rows) const
+    {
+        auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+        auto mr = _detail::effective(m_resource);
+        std::pmr::vector<_detail::input_params> batch{ mr };
+        for (auto const& row : rows)
+        {
+            auto& params = batch.emplace_back(mr);
+            std::apply([&params](auto const& ...values) { (..., params.add(values)); }, row);
+        }
+        return _detail::executor::execute_batch(batch, m_stmt, m_tra, _detail::effective(m_deadline), mr);
     }
 
 private:
-    statement(Firebird::IStatement* stmt, Firebird::ThrowStatusWrapper& status, Firebird::ITransaction* tra)
-        : m_status{ status }, m_tra{ tra }, m_stmt{ stmt }
+    statement(Firebird::IStatement* stmt, Firebird::ITransaction* tra, deadline const& d, std::pmr::memory_resource* mr)
+        : m_tra{ tra }, m_stmt{ stmt }, m_deadline{ d }, m_resource{ mr }
     {}
 
 private:
     friend class transaction;
-    Firebird::ThrowStatusWrapper& m_status;
     Firebird::ITransaction* m_tra;
     Firebird::IStatement* m_stmt;
+    deadline m_deadline;
+    std::pmr::memory_resource* m_resource;  // own one, the scoped one applies when not set
 
     _detail::input_params m_iparams;
+    _detail::usage_guard m_guard;
 };
 
 
@@ -1621,27 +2784,44 @@ public:
 
     transaction(transaction&& rhs) noexcept
         : m_att{ rhs.m_att }
-        , m_status{ rhs.m_status }
         , m_tra{ rhs.m_tra }
+        , m_deadline{ rhs.m_deadline }
+        , m_resource{ rhs.m_resource }
     {
         rhs.m_tra = nullptr;
     }
 
     ~transaction()
     {
-        if (m_tra) m_tra->rollback(&m_status);
+        try
+        {
+            if (m_tra) m_tra->rollback(&_detail::status());
+        }
+        catch (const Firebird::FbException&)
+        {
+            // the attachment may be lost already, the server rolls the transaction back then
+            m_tra->release();
+        }
     }
 
     void commit()
     {
-        m_tra->commit(&m_status);
-        m_tra = nullptr;
+        try
+        {
+            m_tra->commit(&_detail::status());
+            m_tra = nullptr;
+        }
+        CATCH_SQL
     }
 
     void rollback()
     {
-        m_tra->rollback(&m_status);
-        m_tra = nullptr;
+        try
+        {
+            m_tra->rollback(&_detail::status());
+            m_tra = nullptr;
+        }
+        CATCH_SQL
     }
 
     statement prepare(const char* sql) const
@@ -1649,8 +2829,8 @@ public:
         using namespace Firebird;
         try
         {
-            IStatement* stmt = m_att->prepare(&m_status, m_tra, 0, sql, SQL_DIALECT_V6, IStatement::PREPARE_PREFETCH_METADATA);
-            return statement{ stmt, m_status, m_tra };
+            IStatement* stmt = m_att->prepare(&_detail::status(), m_tra, 0, sql, SQL_DIALECT_V6, IStatement::PREPARE_PREFETCH_METADATA);
+            return statement{ stmt, m_tra, m_deadline, m_resource };
         }
         CATCH_SQL
     }
@@ -1661,40 +2841,53 @@ public:
         using namespace Firebird;
         try
         {
-            IStatement* stmt = m_att->prepare(&m_status, m_tra, 0, sql, SQL_DIALECT_V6, IStatement::PREPARE_PREFETCH_METADATA);
-            statement st{ stmt, m_status, m_tra };
+            IStatement* stmt = m_att->prepare(&_detail::status(), m_tra, 0, sql, SQL_DIALECT_V6, IStatement::PREPARE_PREFETCH_METADATA);
+            statement st{ stmt, m_tra, m_deadline, m_resource };
             (..., st.add(std::forward<Args>(args)));
             return st;
         }
         CATCH_SQL
     }
 
+    /// <summary>
+    /// Take buffers of result sets and parameters of this transaction and statements it prepares
+    /// afterwards from a memory resource
+    /// </summary>
+    /// <param name="resource">- memory resource, outliving the result sets; nullptr for the scoped one</param>
+    transaction& use_memory(std::pmr::memory_resource* resource)
+    {
+        m_resource = resource;
+        return *this;
+    }
+
     void execute(const char* sql) const
     {
-        return _detail::executor::execute(m_att, m_status, m_tra, sql);
+        return _detail::executor::execute({}, m_att, m_tra, sql, _detail::effective(m_deadline), _detail::effective(m_resource));
     }
 
     template <typename ...Args>
     void execute(const char* sql, Args&& ...args) const
     {
-        _detail::input_params params;
+        auto mr = _detail::effective(m_resource);
+        _detail::input_params params{ mr };
         (..., params.add(std::forward<Args>(args)));
 
-        return _detail::executor::execute(params, m_att, m_status, m_tra, sql);
+        return _detail::executor::execute(params, m_att, m_tra, sql, _detail::effective(m_deadline), mr);
     }
 
     result_set cursor(const char* sql) const
     {
-        return _detail::executor::cursor({}, m_att, m_status, m_tra, sql);
+        return _detail::executor::cursor({}, m_att, m_tra, sql, _detail::effective(m_deadline), _detail::effective(m_resource));
     }
 
     template <typename ...Args>
     result_set cursor(const char* sql, Args&& ...args) const
     {
-        _detail::input_params params;
+        auto mr = _detail::effective(m_resource);
+        _detail::input_params params{ mr };
         (..., params.add(std::forward<Args>(args)));
 
-        return _detail::executor::cursor(params, m_att, m_status, m_tra, sql);
+        return _detail::executor::cursor(params, m_att, m_tra, sql, _detail::effective(m_deadline), mr);
     }
 
     /// <summary>
@@ -1705,7 +2898,7 @@ public:
     {
         try
         {
-            return blob{ m_att, m_tra, m_status };
+            return blob{ m_att, m_tra, m_deadline };
         }
         CATCH_SQL
     }
@@ -1721,26 +2914,36 @@ public:
         auto id = rs.get(column_number).as<ISC_QUAD>();
         try
         {
-            return blob{ m_att, m_tra, m_status, id };
+            return blob{ m_att, m_tra, id, m_deadline };
         }
         CATCH_SQL
     }
 
+    /// <summary>
+    /// Transaction interface, for calls not covered by this class
+    /// </summary>
+    Firebird::ITransaction* handle() const
+    {
+        return m_tra;
+    }
+
 private:
-    transaction(Firebird::IAttachment* att, Firebird::ThrowStatusWrapper& status)
-        : m_att{ att }, m_status{ status }
+    transaction(Firebird::IAttachment* att, std::pmr::memory_resource* mr)
+        : m_att{ att }, m_resource{ mr }
     {
-        m_tra = att->startTransaction(&status, 0, NULL);
+        m_tra = att->startTransaction(&_detail::status(), 0, NULL);
     }
 
-    transaction(Firebird::IAttachment* att, Firebird::ThrowStatusWrapper& status,
-        isolation_level const& il, lock_resolution const& lr, data_access const& da)
-        : m_att{ att }, m_status{ status }
+    transaction(Firebird::IAttachment* att,
+        isolation_level const& il, lock_resolution const& lr, data_access const& da, deadline const& d,
+        std::pmr::memory_resource* mr)
+        : m_att{ att }, m_deadline{ d }, m_resource{ mr }
     {
         using namespace Firebird;
         using namespace _detail;
 
-        auto tpb = make_autodestroy(util()->getXpbBuilder(&m_status, IXpbBuilder::TPB, nullptr, 0));
+        auto& status = _detail::status();
+        auto tpb = make_autodestroy(util()->getXpbBuilder(&status, IXpbBuilder::TPB, nullptr, 0));
         switch (il.mode)
         {
         case isolation_level::il_concurrency:
@@ -1777,8 +2980,16 @@ private:
         if (lr.mode)
         {
             tpb->insertTag(&status, isc_tpb_wait);
-            if (lr.timeout > 0)
-                tpb->insertInt(&status, isc_tpb_lock_timeout, lr.timeout);
+            int timeout = lr.timeout;
+            if (d.is_set())
+            {
+                // lock waits must not outlive the deadline
+                int left = static_cast<int>(remaining<std::chrono::seconds>(d));
+                if (timeout <= 0 || timeout > left)
+                    timeout = left;
+            }
+            if (timeout > 0)
+                tpb->insertInt(&status, isc_tpb_lock_timeout, timeout);
         }
         else
             tpb->insertTag(&status, isc_tpb_nowait);
@@ -1793,18 +3004,178 @@ private:
 
 private:
     friend class connection;
+    friend class statement;
     Firebird::IAttachment* m_att;
-    Firebird::ThrowStatusWrapper& m_status;
     Firebird::ITransaction* m_tra;
+    deadline m_deadline;
+    std::pmr::memory_resource* m_resource{};
 };
 
 
+inline statement& statement::rebind(transaction const& tra)
+{
+    auto busy = m_guard.enter("fbsqlxx::statement is used by several threads at once");
+    m_tra = tra.m_tra;
+    m_deadline = tra.m_deadline;
+    m_resource = tra.m_resource;
+    return *this;
+}
+
+
 static inline int64_t portable_integer(const uint8_t* p, short length)
 {
     return isc_portable_integer(p, length);
 }
 
 
+/// <summary>
+/// One item of an info reply: tag, value length and pointer to the value
+/// </summary>
+struct info_item
+{
+    uint8_t item;
+    short length;
+    const uint8_t* data;
+
+    int64_t as_integer() const
+    {
+        return portable_integer(data, length);
+    }
+};
+
+/// <summary>
+/// Walks the items of an info reply in place, without copying or allocations.
+/// The buffer is checked once on construction, it must outlive the reader.
+/// </summary>
+class info_reader
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = info_item;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const info_item*;
+        using reference = info_item;
+
+        explicit iterator(const uint8_t* p = nullptr)
+            : m_p{ p }
+        {}
+
+        info_item operator*() const
+        {
+            return { m_p[0], static_cast<short>(portable_integer(m_p + 1, 2)), m_p + 3 };
+        }
+
+        iterator& operator++()
+        {
+            m_p += 3 + portable_integer(m_p + 1, 2);
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        bool operator==(iterator const& rhs) const { return m_p == rhs.m_p; }
+        bool operator!=(iterator const& rhs) const { return m_p != rhs.m_p; }
+
+    private:
+        const uint8_t* m_p;
+    };
+
+    /// <summary>
+    /// Check an info reply and find its end
+    /// </summary>
+    /// <param name="buffer">- reply buffer</param>
+    /// <param name="length">- buffer size in bytes</param>
+    info_reader(const uint8_t* buffer, size_t length)
+        : m_begin{ buffer }, m_end{ buffer }
+    {
+        auto end = buffer + length;
+        while (m_end < end && *m_end != isc_info_end)
+        {
+            if (*m_end == isc_info_truncated)
+                throw logic_error("info_reader - output buffer is truncated");
+            if (end - m_end < 3)
+                break;
+
+            auto next = m_end + 3 + portable_integer(m_end + 1, 2);
+            if (next > end)
+                break;
+            m_end = next;
+        }
+
+        if (m_end == end || *m_end != isc_info_end)
+            throw logic_error("info_reader - output buffer is broken");
+    }
+
+    iterator begin() const { return iterator{ m_begin }; }
+    iterator end() const { return iterator{ m_end }; }
+
+    /// <summary>
+    /// Size of the reply including the terminating isc_info_end
+    /// </summary>
+    size_t length() const
+    {
+        return static_cast<size_t>(m_end - m_begin) + 1;
+    }
+
+private:
+    const uint8_t* m_begin;
+    const uint8_t* m_end;   // points to isc_info_end
+};
+
+
+/// <summary>
+/// Database counters and versions, see connection::db_info()
+/// </summary>
+struct database_info
+{
+    int64_t page_size{};
+    int64_t ods_version{};
+    int64_t ods_minor_version{};
+    int64_t oldest_transaction{};
+    int64_t oldest_active{};
+    int64_t oldest_snapshot{};
+    int64_t next_transaction{};
+    int64_t reads{};            // page reads of this attachment
+    int64_t writes{};
+    int64_t fetches{};
+    int64_t marks{};
+    int64_t current_memory{};   // bytes
+    int64_t max_memory{};
+
+    /// <summary>
+    /// Transactions since the oldest interesting one, garbage below it is collected by sweep only
+    /// </summary>
+    int64_t interesting_gap() const
+    {
+        return next_transaction - oldest_transaction;
+    }
+
+    /// <summary>
+    /// Transactions since the oldest active one, a long running transaction makes it grow
+    /// </summary>
+    int64_t active_gap() const
+    {
+        return next_transaction - oldest_active;
+    }
+
+    /// <summary>
+    /// Transactions since the oldest snapshot, record versions newer than it can't be collected
+    /// </summary>
+    int64_t snapshot_gap() const
+    {
+        return next_transaction - oldest_snapshot;
+    }
+};
+
+
 struct connection_params
 {
     const char* database;
@@ -1818,48 +3189,127 @@ struct connection_params
     int connect_timeout;
     int dialect{ SQL_DIALECT_CURRENT };
     bool trusted_auth;
+    int parallel_workers{};     // workers for sweep and index creation, Firebird 5 and later, up to MaxParallelWorkers
 };
 
+
+namespace _detail {
+
+// owning copy of connection parameters, to attach again later
+class params_holder
+{
+public:
+    explicit params_holder(connection_params const& params)
+        : m_params{ params }
+    {
+        keep(m_database, m_params.database);
+        keep(m_user, m_params.user);
+        keep(m_password, m_params.password);
+        keep(m_role, m_params.role);
+        keep(m_lc_messages, m_params.lc_messages);
+        keep(m_lc_ctype, m_params.lc_ctype);
+        keep(m_session_time_zone, m_params.session_time_zone);
+        keep(m_trusted_role, m_params.trusted_role);
+    }
+
+    params_holder(params_holder const& rhs)
+        : params_holder{ rhs.m_params }
+    {}
+
+    params_holder& operator=(params_holder const&) = delete;
+
+    connection_params const& get() const
+    {
+        return m_params;
+    }
+
+private:
+    static void keep(std::string& storage, const char*& value)
+    {
+        if (value)
+        {
+            storage = value;
+            value = storage.c_str();
+        }
+    }
+
+private:
+    connection_params m_params;
+    std::string m_database;
+    std::string m_user;
+    std::string m_password;
+    std::string m_role;
+    std::string m_lc_messages;
+    std::string m_lc_ctype;
+    std::string m_session_time_zone;
+    std::string m_trusted_role;
+};
+
+} // namespace _detail
+
 class connection
 {
 public:
-    connection(const connection_params& params)
-        : m_status{ _detail::master()->getStatus() }
-        , m_att{ nullptr }
+    /// <summary>
+    /// Attach to a database
+    /// </summary>
+    /// <param name="params">- connection parameters</param>
+    /// <param name="d">- deadline, limits connect timeout together with the scoped one, optional</param>
+    connection(const connection_params& params, deadline d = {})
+        : m_att{ nullptr }
     {
         if (!params.database) throw logic_error("Database location must be supplied");
 
+        d = _detail::effective(d);
+        _detail::check(d, "fbsqlxx::connection - deadline exceeded");
+
         using namespace Firebird;
         using namespace _detail;
 
-        auto dpb = make_autodestroy(util()->getXpbBuilder(&m_status, IXpbBuilder::DPB, nullptr, 0));
+        auto& status = _detail::status();
+        auto dpb = make_autodestroy(util()->getXpbBuilder(&status, IXpbBuilder::DPB, nullptr, 0));
         if (params.user)
-            dpb->insertString(&m_status, isc_dpb_user_name, params.user);
+            dpb->insertString(&status, isc_dpb_user_name, params.user);
         if (params.password)
-            dpb->insertString(&m_status, isc_dpb_password, params.password);
+            dpb->insertString(&status, isc_dpb_password, params.password);
         if (params.role)
-            dpb->insertString(&m_status, isc_dpb_sql_role_name, params.role);
+            dpb->insertString(&status, isc_dpb_sql_role_name, params.role);
         if (params.lc_ctype)
-            dpb->insertString(&m_status, isc_dpb_lc_ctype, params.lc_ctype);
+            dpb->insertString(&status, isc_dpb_lc_ctype, params.lc_ctype);
         if (params.lc_messages)
-            dpb->insertString(&m_status, isc_dpb_lc_messages, params.lc_messages);
+            dpb->insertString(&status, isc_dpb_lc_messages, params.lc_messages);
         if (params.session_time_zone)
-            dpb->insertString(&m_status, isc_dpb_session_time_zone, params.session_time_zone);
+            dpb->insertString(&status, isc_dpb_session_time_zone, params.session_time_zone);
 
         if (params.trusted_auth)
-            dpb->insertTag(&m_status, isc_dpb_trusted_auth);
+            dpb->insertTag(&status, isc_dpb_trusted_auth);
         if (params.trusted_role)
-            dpb->insertString(&m_status, isc_dpb_trusted_role, params.trusted_role);
+            dpb->insertString(&status, isc_dpb_trusted_role, params.trusted_role);
 
-        if (params.connect_timeout > 0)
-            dpb->insertInt(&m_status, isc_dpb_connect_timeout, params.connect_timeout);
+        int connect_timeout = params.connect_timeout;
+        if (d.is_set())
+        {
+            int left = static_cast<int>(remaining<std::chrono::seconds>(d));
+            if (connect_timeout <= 0 || connect_timeout > left)
+                connect_timeout = left;
+        }
+        if (connect_timeout > 0)
+            dpb->insertInt(&status, isc_dpb_connect_timeout, connect_timeout);
 
-        dpb->insertInt(&m_status, isc_dpb_sql_dialect, params.dialect);
+        dpb->insertInt(&status, isc_dpb_sql_dialect, params.dialect);
+        if (params.parallel_workers > 0)
+        {
+#ifdef isc_dpb_parallel_workers
+            dpb->insertInt(&status, isc_dpb_parallel_workers, params.parallel_workers);
+#else
+            throw logic_error("fbsqlxx::connection - parallel workers need Firebird 5 client headers");
+#endif
+        }
 
         try
         {
             auto provider = make_autodestroy(master()->getDispatcher());
-            m_att = provider->attachDatabase(&m_status, params.database, dpb->getBufferLength(&m_status), dpb->getBuffer(&m_status));
+            m_att = provider->attachDatabase(&status, params.database, dpb->getBufferLength(&status), dpb->getBuffer(&status));
         }
         CATCH_SQL
     }
@@ -1868,7 +3318,7 @@ public:
     {
         try
         {
-            if (m_att) m_att->detach(&m_status);
+            if (m_att) m_att->detach(&_detail::status());
         }
         catch (const Firebird::FbException& ex)
         {
@@ -1877,8 +3327,6 @@ public:
             _detail::util()->formatStatus(buf, sizeof(buf), ex.getStatus());
             //std::cerr << buf << std::endl;
         }
-
-        m_status.dispose();
     }
 
     connection(const connection&) = delete;
@@ -1886,12 +3334,22 @@ public:
     connection& operator=(const connection&) = delete;
 
     connection(connection&& rhs) noexcept
-        : m_status{ _detail::master()->getStatus() } // create new status, old would be disposed
-        , m_att{ rhs.m_att }
+        : m_att{ rhs.m_att }
+        , m_resource{ rhs.m_resource }
     {
         rhs.m_att = nullptr;
     }
 
+    /// <summary>
+    /// Take buffers of result sets and parameters of transactions started afterwards from a memory resource
+    /// </summary>
+    /// <param name="resource">- memory resource, outliving the result sets; nullptr for the scoped one</param>
+    connection& use_memory(std::pmr::memory_resource* resource)
+    {
+        m_resource = resource;
+        return *this;
+    }
+
     /// <summary>
     /// Ping database server
     /// </summary>
@@ -1899,7 +3357,7 @@ public:
     {
         try
         {
-            m_att->ping(&m_status);
+            m_att->ping(&_detail::status());
         }
         CATCH_SQL
     }
@@ -1915,31 +3373,73 @@ public:
         tra.commit();
     }
 
+    /// <summary>
+    /// Start a server-side profiler session for this attachment (Firebird 5 and later)
+    /// </summary>
+    /// <param name="session_name">- session description</param>
+    /// <returns>profile id, the key of PLG$PROF_* tables rows</returns>
+    int64_t start_profiling(const char* session_name)
+    {
+        auto tra = start(isolation_level::read_committed(true), lock_resolution::wait());
+        auto rs = tra.cursor("select rdb$profiler.start_session(?) from rdb$database", session_name);
+        rs.next();
+        auto id = rs.get(0).as<int64_t>();
+        rs.close();
+        tra.commit();
+        return id;
+    }
+
+    /// <summary>
+    /// Finish the profiler session of this attachment and write its data to PLG$PROF_* tables
+    /// </summary>
+    void finish_profiling()
+    {
+        auto tra = start(isolation_level::read_committed(true), lock_resolution::wait());
+        tra.execute("execute procedure rdb$profiler.finish_session(true)");
+        tra.commit();
+    }
+
     /// <summary>
     /// Start new transaction with default options
     /// </summary>
     /// <returns>transaction object</returns>
     transaction start()
     {
+        if (_detail::scoped_deadline().is_set())
+            return start(deadline{});
+
         try
         {
-            return transaction{ m_att, m_status };
+            return transaction{ m_att, m_resource };
         }
         CATCH_SQL
     }
 
+    /// <summary>
+    /// Start new transaction with default options (snapshot, wait, read-write) and a deadline
+    /// </summary>
+    /// <param name="d">- deadline of the transaction's work, combined with the scoped one</param>
+    /// <returns>transaction object</returns>
+    transaction start(deadline d)
+    {
+        return start(isolation_level::concurrency(), {}, {}, d);
+    }
+
     /// <summary>
     /// Start new transaction with specific options
     /// </summary>
     /// <param name="il">- isolation_level, snapshot, stability or read committed</param>
     /// <param name="lr">- lock_resolution, wait or no wait</param>
     /// <param name="da">- data_access, read only or read-write</param>
+    /// <param name="d">- deadline of the transaction's work, combined with the scoped one, optional</param>
     /// <returns>transaction object</returns>
-    transaction start(isolation_level il, lock_resolution lr = {}, data_access da = {})
+    transaction start(isolation_level il, lock_resolution lr = {}, data_access da = {}, deadline d = {})
     {
+        d = _detail::effective(d);
+        _detail::check(d, "fbsqlxx::connection::start() - deadline exceeded");
         try
         {
-            return transaction{ m_att, m_status, il, lr, da };
+            return transaction{ m_att, il, lr, da, d, m_resource };
         }
         CATCH_SQL
     }
@@ -1954,45 +3454,95 @@ public:
         info(std::initializer_list<uint8_t> items, size_t buffer_size = 16 * 1024) const
     {
         std::vector<uint8_t> buffer(buffer_size);
-        std::vector<uint8_t> _items{ items };
-        _items.push_back(isc_info_end);
+        auto reply = info(items.begin(), static_cast<unsigned>(items.size()), buffer.data(), static_cast<unsigned>(buffer.size()));
+        buffer.resize(reply.length());
+        return buffer;
+    }
+
+    /// <summary>
+    /// Database metadata info request into a caller's buffer, does not allocate
+    /// </summary>
+    /// <param name="items">- <em>enum db_info_types</em> constants (isc_info_*, fb_info_*)</param>
+    /// <param name="items_length">- number of items</param>
+    /// <param name="buffer">- output buffer</param>
+    /// <param name="buffer_length">- output buffer size in bytes</param>
+    /// <returns>reader of the reply items</returns>
+    info_reader info(const uint8_t* items, unsigned items_length, uint8_t* buffer, unsigned buffer_length) const
+    {
         try
         {
-            auto status = _detail::make_autodestroy(_detail::master()->getStatus());
-            Firebird::ThrowStatusWrapper wrapper{ &status };
-            m_att->getInfo(&wrapper, static_cast<unsigned>(_items.size()), _items.data(),
-                static_cast<unsigned>(buffer.size()), buffer.data());
+            m_att->getInfo(&_detail::status(), items_length, items, buffer_length, buffer);
+        }
+        CATCH_SQL
 
-            if (buffer[0] == isc_info_truncated)
-                throw logic_error("connection::info() - output buffer is truncated");
+        return info_reader{ buffer, buffer_length };
+    }
 
-            auto it = std::find(buffer.cbegin(), buffer.cend(), isc_info_end);
-            if (it == buffer.cend())
-                throw logic_error("connection::info() - output buffer is broken");
+    /// <summary>
+    /// Database counters and versions, collected with one info request
+    /// </summary>
+    database_info db_info() const
+    {
+        uint8_t buffer[256];
+        return db_info(buffer, sizeof(buffer));
+    }
 
-            return { buffer.cbegin(), it + 1 };
+    /// <summary>
+    /// Database counters and versions, collected with one info request into a caller's buffer
+    /// </summary>
+    /// <param name="buffer">- output buffer, 256 bytes are enough</param>
+    /// <param name="buffer_length">- output buffer size in bytes</param>
+    database_info db_info(uint8_t* buffer, unsigned buffer_length) const
+    {
+        static const uint8_t items[] = {
+            isc_info_page_size, isc_info_ods_version, isc_info_ods_minor_version,
+            isc_info_oldest_transaction, isc_info_oldest_active, isc_info_oldest_snapshot, isc_info_next_transaction,
+            isc_info_reads, isc_info_writes, isc_info_fetches, isc_info_marks,
+            isc_info_current_memory, isc_info_max_memory
+        };
+
+        database_info res;
+        for (auto i : info(items, sizeof(items), buffer, buffer_length))
+        {
+            auto value = i.as_integer();
+            switch (i.item)
+            {
+            case isc_info_page_size: res.page_size = value; break;
+            case isc_info_ods_version: res.ods_version = value; break;
+            case isc_info_ods_minor_version: res.ods_minor_version = value; break;
+            case isc_info_oldest_transaction: res.oldest_transaction = value; break;
+            case isc_info_oldest_active: res.oldest_active = value; break;
+            case isc_info_oldest_snapshot: res.oldest_snapshot = value; break;
+            case isc_info_next_transaction: res.next_transaction = value; break;
+            case isc_info_reads: res.reads = value; break;
+            case isc_info_writes: res.writes = value; break;
+            case isc_info_fetches: res.fetches = value; break;
+            case isc_info_marks: res.marks = value; break;
+            case isc_info_current_memory: res.current_memory = value; break;
+            case isc_info_max_memory: res.max_memory = value; break;
+            }
         }
-        CATCH_SQL
+        return res;
     }
 
     template <typename Func>
     static void parse_info_buffer(std::vector<uint8_t> const& buffer, Func func)
     {
-        for (auto p = buffer.cbegin(); p != buffer.cend() && *p != isc_info_end; )
-        {
-            uint8_t item = *p++;
-            short length = portable_integer(std::addressof(*p), 2);
-            p += 2;
-
-            func(item, length, std::addressof(*p));
+        for (auto i : info_reader{ buffer.data(), buffer.size() })
+            func(i.item, i.length, i.data);
+    }
 
-            p += length;
-        }
+    /// <summary>
+    /// Attachment interface, for calls not covered by this class
+    /// </summary>
+    Firebird::IAttachment* handle() const
+    {
+        return m_att;
     }
 
 private:
-    Firebird::ThrowStatusWrapper m_status;
     Firebird::IAttachment* m_att;
+    std::pmr::memory_resource* m_resource{};
 };
 
 
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_service.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+struct backup_options
+{
+    bool compress{};            // compress the stream on the server, Firebird 4 and later
+    bool ignore_limbo{};        // skip limbo transactions
+};
+
+struct restore_options
+{
+    bool replace{};             // overwrite an existing database, otherwise create a new one
+    bool verbose{ true };       // report every gbak message as progress
+};
+
+struct backup_progress
+{
+    uint64_t bytes{};           // backup stream bytes passed so far
+    std::string message;        // gbak verbose message, restore only
+};
+
+using progress_func = std::function<void(backup_progress const&)>;
+
+
+/// <summary>
+/// Back up a database to a stream, without temporary files
+/// </summary>
+/// <param name="params">- services manager connection parameters</param>
+/// <param name="database">- database path or alias on the server</param>
+/// <param name="sink">- callable, takes <em>const char*</em> data and <em>size_t</em> size of every chunk</param>
+/// <param name="options">- backup options, optional</param>
+/// <param name="progress">- called after every chunk, optional</param>
+/// <returns>backup size in bytes</returns>
+template <typename Sink>
+uint64_t backup(service_params const& params, const char* database, Sink&& sink,
+    backup_options const& options = {}, progress_func const& progress = {})
+{
+    int flags = 0;
+    if (options.compress)
+        flags |= isc_spb_bkp_zip;
+    if (options.ignore_limbo)
+        flags |= isc_spb_bkp_ignore_limbo;
+
+    service svc{ params };
+    service_action action{ isc_action_svc_backup };
+    action.add(isc_spb_dbname, database).add(isc_spb_bkp_file, "stdout");
+    if (flags)
+        action.add(isc_spb_options, flags);
+    svc.start(action);
+
+    // the backup stream takes the place of the text output, verbose messages are not available
+    backup_progress state;
+    std::string chunk;
+    while (svc.read_text(chunk) != service_output::end)
+    {
+        sink(chunk.data(), chunk.size());
+        state.bytes += chunk.size();
+        if (progress)
+            progress(state);
+    }
+    return state.bytes;
+}
+
+/// <summary>
+/// Back up a database to a file, e.g. a pipe opened with fdopen()
+/// </summary>
+static inline uint64_t backup(service_params const& params, const char* database, std::FILE* file,
+    backup_options const& options = {}, progress_func const& progress = {})
+{
+    return backup(params, database, [file](const char* data, size_t size)
+        {
+            if (std::fwrite(data, 1, size, file) != size)
+                throw logic_error("fbsqlxx::backup() - write to file failed");
+        }, options, progress);
+}
+
+/// <summary>
+/// Restore a database from a stream
+/// </summary>
+/// <param name="params">- services manager connection parameters</param>
+/// <param name="source">- callable, takes <em>char*</em> buffer and <em>size_t</em> size, returns bytes read, zero at the end</param>
+/// <param name="database">- database path or alias on the server</param>
+/// <param name="options">- restore options, optional</param>
+/// <param name="progress">- called after every chunk and gbak message, optional</param>
+/// <returns>bytes read from the source</returns>
+template <typename Source>
+uint64_t restore(service_params const& params, Source&& source, const char* database,
+    restore_options const& options = {}, progress_func const& progress = {})
+{
+    service svc{ params };
+    service_action action{ isc_action_svc_restore };
+    action.add(isc_spb_bkp_file, "stdin").add(isc_spb_dbname, database)
+        .add(isc_spb_options, options.replace ? isc_spb_res_replace : isc_spb_res_create);
+    if (options.verbose)
+        action.add(isc_spb_verbose);
+    svc.start(action);
+
+    // the service asks for stdin data in the reply, it is sent with the next query
+    static const unsigned char items[] = { isc_info_svc_stdin, isc_info_svc_line };
+    static const size_t max_chunk = 32 * 1024;
+    std::vector<unsigned char> send(3 + max_chunk);
+    std::vector<unsigned char> reply(16 * 1024);
+    backup_progress state;
+    size_t requested = 0;
+    bool eof = false;
+    for (;;)
+    {
+        unsigned send_length = 0;
+        if (requested)
+        {
+            size_t got = 0;
+            if (!eof)
+            {
+                got = source(reinterpret_cast<char*>(send.data() + 3), std::min(requested, max_chunk));
+                eof = got == 0;
+                state.bytes += got;
+            }
+            // zero length tells the service the stream has ended
+            send[0] = isc_info_svc_line;
+            send[1] = static_cast<unsigned char>(got);
+            send[2] = static_cast<unsigned char>(got >> 8);
+            send_length = static_cast<unsigned>(3 + got);
+        }
+
+        svc.query(send_length, send.data(), sizeof(items), items, static_cast<unsigned>(reply.size()), reply.data());
+
+        requested = 0;
+        state.message.clear();
+        bool busy = false;
+        auto p = reply.data();
+        auto end = p + reply.size();
+        while (p < end && *p != isc_info_end)
+        {
+            auto tag = *p++;
+            if (tag == isc_info_svc_stdin && end - p >= 4)
+            {
+                requested = static_cast<size_t>(portable_integer(p, 4));
+                p += 4;
+            }
+            else if (tag == isc_info_svc_line && end - p >= 2)
+            {
+                auto length = static_cast<size_t>(portable_integer(p, 2));
+                p += 2;
+                if (length > static_cast<size_t>(end - p))
+                    throw logic_error("fbsqlxx::restore() - output buffer is broken");
+                state.message.assign(reinterpret_cast<const char*>(p), length);
+                p += length;
+            }
+            else if (tag == isc_info_data_not_ready || tag == isc_info_truncated)
+                busy = true;
+            else
+                throw logic_error("fbsqlxx::restore() - unexpected output item");
+        }
+
+        if (progress && (send_length || !state.message.empty()))
+            progress(state);
+        if (!requested && !busy && state.message.empty())
+            break;
+    }
+    return state.bytes;
+}
+
+/// <summary>
+/// Restore a database from a file, e.g. a pipe opened with fdopen()
+/// </summary>
+static inline uint64_t restore(service_params const& params, std::FILE* file, const char* database,
+    restore_options const& options = {}, progress_func const& progress = {})
+{
+    return restore(params, [file](char* buffer, size_t size)
+        {
+            auto got = std::fread(buffer, 1, size, file);
+            if (got == 0 && std::ferror(file))
+                throw logic_error("fbsqlxx::restore() - read from file failed");
+            return got;
+        }, database, options, progress);
+}
+
+} // namespace fbsqlxx
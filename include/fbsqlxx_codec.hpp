@@ -0,0 +1,437 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+namespace _detail {
+
+// Layout: "FBXR", a version byte, the column count and per column its type with the nullable bit,
+// sub-type, length, scale, charset, field name and alias. Then rows: a null bitmap, a bit per column,
+// and the values of non-null columns. Integers, dates and times are varints (signed ones zigzag),
+// text is length-prefixed with CHAR padding removed, other types are stored as in the message.
+static constexpr char codec_magic[4] = { 'F', 'B', 'X', 'R' };
+static constexpr unsigned char codec_version = 1;
+
+struct codec_column
+{
+    unsigned type;
+    unsigned length;
+    unsigned offset;
+    unsigned null_offset;
+    char pad;                   // CHAR padding, zero for OCTETS
+};
+
+static inline std::vector<codec_column> codec_columns(Firebird::IMessageMetadata* meta)
+{
+    auto& st = status();
+    std::vector<codec_column> res;
+    for (unsigned i = 0; i < meta->getCount(&st); ++i)
+    {
+        res.push_back({ meta->getType(&st, i) & ~1u, meta->getLength(&st, i), meta->getOffset(&st, i),
+            meta->getNullOffset(&st, i), meta->getCharSet(&st, i) == 1 ? '\0' : ' ' });
+    }
+    return res;
+}
+
+static inline void put_varint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static inline void put_zigzag(std::string& out, int64_t value)
+{
+    put_varint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+static inline void put_string(std::string& out, const char* data, size_t length)
+{
+    put_varint(out, length);
+    out.append(data, length);
+}
+
+// bounds-checked reader of encoded data
+class codec_reader
+{
+public:
+    codec_reader(const unsigned char* data, size_t size)
+        : m_pos{ data }, m_end{ data + size }
+    {}
+
+    bool at_end() const
+    {
+        return m_pos == m_end;
+    }
+
+    const unsigned char* take(size_t size)
+    {
+        if (static_cast<size_t>(m_end - m_pos) < size)
+            throw logic_error("fbsqlxx::row_decoder - data is truncated");
+        auto res = m_pos;
+        m_pos += size;
+        return res;
+    }
+
+    uint64_t varint()
+    {
+        uint64_t res = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            auto b = *take(1);
+            res |= uint64_t{ b & 0x7Fu } << shift;
+            if (!(b & 0x80))
+                return res;
+        }
+        throw logic_error("fbsqlxx::row_decoder - bad varint");
+    }
+
+    int64_t zigzag()
+    {
+        auto v = varint();
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    std::string_view string()
+    {
+        auto length = static_cast<size_t>(varint());
+        return { reinterpret_cast<const char*>(take(length)), length };
+    }
+
+private:
+    const unsigned char* m_pos;
+    const unsigned char* m_end;
+};
+
+} // namespace _detail
+
+
+/// <summary>
+/// Encoder of rows into a compact binary form, self-described by a header made of the row metadata.
+/// Decode with row_decoder. BLOB and ARRAY columns are rejected, their ids mean nothing to another
+/// connection; cast text blobs to VARCHAR in the query.
+/// </summary>
+class row_encoder final
+{
+public:
+    explicit row_encoder(Firebird::IMessageMetadata* meta)
+        : m_meta{ meta }
+        , m_columns{ _detail::codec_columns(meta) }
+    {
+        for (auto const& c : m_columns)
+        {
+            if (c.type == SQL_BLOB || c.type == SQL_ARRAY)
+                throw logic_error("fbsqlxx::row_encoder - BLOB and ARRAY columns can not be encoded");
+        }
+    }
+
+    /// <summary>
+    /// Append the header, once before the rows
+    /// </summary>
+    void write_header(std::string& out) const
+    {
+        using namespace _detail;
+
+        auto& st = status();
+        out.append(codec_magic, sizeof(codec_magic));
+        out += static_cast<char>(codec_version);
+        put_varint(out, m_columns.size());
+        for (unsigned i = 0; i < m_columns.size(); ++i)
+        {
+            put_varint(out, m_columns[i].type | (m_meta->isNullable(&st, i) ? 1u : 0u));
+            put_zigzag(out, m_meta->getSubType(&st, i));
+            put_varint(out, m_columns[i].length);
+            put_zigzag(out, m_meta->getScale(&st, i));
+            put_varint(out, m_meta->getCharSet(&st, i));
+            std::string name = m_meta->getField(&st, i);
+            std::string alias = m_meta->getAlias(&st, i);
+            put_string(out, name.data(), name.size());
+            put_string(out, alias.data(), alias.size());
+        }
+    }
+
+    /// <summary>
+    /// Append a row message of the encoder's metadata
+    /// </summary>
+    void write_row(const unsigned char* message, std::string& out) const
+    {
+        using namespace _detail;
+
+        auto bitmap = out.size();
+        out.append((m_columns.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < m_columns.size(); ++i)
+        {
+            auto const& c = m_columns[i];
+            if (*reinterpret_cast<const short*>(message + c.null_offset))
+            {
+                out[bitmap + i / 8] |= static_cast<char>(1 << (i % 8));
+                continue;
+            }
+
+            auto data = message + c.offset;
+            switch (c.type)
+            {
+            case SQL_SHORT:
+                put_zigzag(out, load<short>(data));
+                break;
+            case SQL_LONG:
+            case SQL_TYPE_DATE:
+                put_zigzag(out, load<int32_t>(data));
+                break;
+            case SQL_INT64:
+                put_zigzag(out, load<int64_t>(data));
+                break;
+            case SQL_TYPE_TIME:
+                put_varint(out, load<ISC_TIME>(data));
+                break;
+            case SQL_TIMESTAMP:
+                put_zigzag(out, load<ISC_DATE>(data));
+                put_varint(out, load<ISC_TIME>(data + sizeof(ISC_DATE)));
+                break;
+            case SQL_VARYING:
+                put_string(out, reinterpret_cast<const char*>(data + sizeof(short)), load<unsigned short>(data));
+                break;
+            case SQL_TEXT:
+            {
+                auto text = reinterpret_cast<const char*>(data);
+                size_t length = c.length;
+                while (length && text[length - 1] == c.pad)
+                    --length;
+                put_string(out, text, length);
+                break;
+            }
+            default:
+                out.append(reinterpret_cast<const char*>(data), c.length);
+                break;
+            }
+        }
+    }
+
+private:
+    Firebird::IMessageMetadata* m_meta;
+    std::vector<_detail::codec_column> m_columns;
+};
+
+/// <summary>
+/// Encode the remaining rows of a result set, header first, in chunks
+/// </summary>
+/// <param name="rs">- result set</param>
+/// <param name="sink">- callable, takes <em>const char*</em> data and <em>size_t</em> size of every chunk</param>
+/// <param name="chunk_size">- bytes collected before calling the sink</param>
+/// <returns>number of rows</returns>
+template <typename Sink>
+uint64_t encode_rows(result_set& rs, Sink&& sink, size_t chunk_size = 64 * 1024)
+{
+    row_encoder encoder{ rs.current().metadata() };
+    std::string chunk;
+    chunk.reserve(chunk_size + 1024);
+    encoder.write_header(chunk);
+
+    uint64_t rows = 0;
+    while (rs.next())
+    {
+        encoder.write_row(rs.current().data(), chunk);
+        ++rows;
+        if (chunk.size() >= chunk_size)
+        {
+            sink(chunk.data(), chunk.size());
+            chunk.clear();
+        }
+    }
+    if (!chunk.empty())
+        sink(chunk.data(), chunk.size());
+    return rows;
+}
+
+/// <summary>
+/// Encode the remaining rows of a result set into one buffer
+/// </summary>
+static inline std::string encode_rows(result_set& rs)
+{
+    std::string res;
+    encode_rows(rs, [&res](const char* data, size_t size) { res.append(data, size); });
+    return res;
+}
+
+
+/// <summary>
+/// Decoder of rows written by row_encoder. Rows are decoded one at a time into a message of the
+/// original layout, so current() and get() give the usual row and field accessors; text() reads
+/// text straight from the encoded data. The data must outlive the decoder.
+/// </summary>
+class row_decoder final
+{
+public:
+    /// <summary>
+    /// Read the header
+    /// </summary>
+    /// <param name="data">- encoded rows</param>
+    /// <param name="size">- size of the data</param>
+    row_decoder(const void* data, size_t size)
+        : m_reader{ static_cast<const unsigned char*>(data), size }
+    {
+        using namespace _detail;
+
+        auto magic = m_reader.take(sizeof(codec_magic));
+        if (!std::equal(std::begin(codec_magic), std::end(codec_magic), reinterpret_cast<const char*>(magic)))
+            throw logic_error("fbsqlxx::row_decoder - data is not encoded rows");
+        if (*m_reader.take(1) != codec_version)
+            throw logic_error("fbsqlxx::row_decoder - unsupported version");
+
+        auto& st = status();
+        auto count = static_cast<unsigned>(m_reader.varint());
+        auto builder = make_autodestroy(master()->getMetadataBuilder(&st, count));
+        for (unsigned i = 0; i < count; ++i)
+        {
+            builder->setType(&st, i, static_cast<unsigned>(m_reader.varint()));
+            builder->setSubType(&st, i, static_cast<int>(m_reader.zigzag()));
+            builder->setLength(&st, i, static_cast<unsigned>(m_reader.varint()));
+            builder->setScale(&st, i, static_cast<int>(m_reader.zigzag()));
+            builder->setCharSet(&st, i, static_cast<unsigned>(m_reader.varint()));
+            builder->setField(&st, i, std::string{ m_reader.string() }.c_str());
+            builder->setAlias(&st, i, std::string{ m_reader.string() }.c_str());
+        }
+        m_meta = builder->getMetadata(&st);
+        m_columns = codec_columns(m_meta);
+        m_message.resize(m_meta->getMessageLength(&st));
+        m_text.resize(count);
+    }
+
+    ~row_decoder()
+    {
+        if (m_meta)
+            m_meta->release();
+    }
+
+    row_decoder(row_decoder const&) = delete;
+    row_decoder& operator=(row_decoder const&) = delete;
+
+    /// <summary>
+    /// Decode the next row, false at the end of the data
+    /// </summary>
+    bool next()
+    {
+        using namespace _detail;
+
+        if (m_reader.at_end())
+            return false;
+
+        auto bitmap = m_reader.take((m_columns.size() + 7) / 8);
+        auto message = m_message.data();
+        for (size_t i = 0; i < m_columns.size(); ++i)
+        {
+            auto const& c = m_columns[i];
+            short null = (bitmap[i / 8] >> (i % 8)) & 1 ? -1 : 0;
+            memcpy(message + c.null_offset, &null, sizeof(null));
+            m_text[i] = {};
+            if (null)
+                continue;
+
+            auto data = message + c.offset;
+            switch (c.type)
+            {
+            case SQL_SHORT:
+                store(data, static_cast<short>(m_reader.zigzag()));
+                break;
+            case SQL_LONG:
+            case SQL_TYPE_DATE:
+                store(data, static_cast<int32_t>(m_reader.zigzag()));
+                break;
+            case SQL_INT64:
+                store(data, m_reader.zigzag());
+                break;
+            case SQL_TYPE_TIME:
+                store(data, static_cast<ISC_TIME>(m_reader.varint()));
+                break;
+            case SQL_TIMESTAMP:
+                store(data, static_cast<ISC_DATE>(m_reader.zigzag()));
+                store(data + sizeof(ISC_DATE), static_cast<ISC_TIME>(m_reader.varint()));
+                break;
+            case SQL_VARYING:
+            case SQL_TEXT:
+            {
+                auto text = m_reader.string();
+                if (text.size() > c.length)
+                    throw logic_error("fbsqlxx::row_decoder - text is longer than its column");
+                m_text[i] = text;
+                if (c.type == SQL_VARYING)
+                {
+                    store(data, static_cast<unsigned short>(text.size()));
+                    memcpy(data + sizeof(short), text.data(), text.size());
+                }
+                else
+                {
+                    memcpy(data, text.data(), text.size());
+                    memset(data + text.size(), c.pad, c.length - text.size());
+                }
+                break;
+            }
+            default:
+                memcpy(data, m_reader.take(c.length), c.length);
+                break;
+            }
+        }
+        return true;
+    }
+
+    unsigned int ncols() const
+    {
+        return static_cast<unsigned int>(m_columns.size());
+    }
+
+    field get(unsigned int index) const
+    {
+        return current().get(index);
+    }
+
+    /// <summary>
+    /// Current row, valid until the next call to next()
+    /// </summary>
+    row current() const
+    {
+        return row{ m_meta, m_message.data() };
+    }
+
+    /// <summary>
+    /// Text of a CHAR or VARCHAR column without copying, CHAR padding removed; empty for NULL
+    /// </summary>
+    std::string_view text(unsigned int index) const
+    {
+        if (index >= m_columns.size())
+        {
+            throw logic_error("Row index out of bounds");
+        }
+
+        return m_text[index];
+    }
+
+    Firebird::IMessageMetadata* metadata() const
+    {
+        return m_meta;
+    }
+
+private:
+    template <typename T>
+    static void store(unsigned char* data, T value)
+    {
+        memcpy(data, &value, sizeof(T));
+    }
+
+private:
+    _detail::codec_reader m_reader;
+    Firebird::IMessageMetadata* m_meta{};
+    std::vector<_detail::codec_column> m_columns;
+    std::vector<unsigned char> m_message;
+    std::vector<std::string_view> m_text;
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,326 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+struct copy_options
+{
+    std::vector<std::string> columns;   // target columns, the source column aliases when empty
+    unsigned block_rows{ 1000 };        // rows fetched and inserted at once
+    unsigned queue_blocks{ 4 };         // blocks fetched ahead of the writer
+};
+
+struct copy_result
+{
+    uint64_t rows{};
+    uint64_t blobs{};
+    uint64_t blob_bytes{};
+};
+
+
+namespace _detail {
+
+// rows in the source message format, one aligned message after another
+struct row_block
+{
+    std::vector<unsigned char> data;
+    unsigned count{};
+};
+
+class block_queue
+{
+public:
+    explicit block_queue(size_t capacity)
+        : m_capacity{ capacity ? capacity : 1 }
+    {}
+
+    // false when the consumer has stopped
+    bool push(row_block&& block)
+    {
+        std::unique_lock<std::mutex> lock{ m_mutex };
+        m_cv.wait(lock, [this] { return m_blocks.size() < m_capacity || m_cancelled; });
+        if (m_cancelled)
+            return false;
+        m_blocks.push_back(std::move(block));
+        m_cv.notify_all();
+        return true;
+    }
+
+    // false when the producer has finished and all blocks are taken
+    bool pop(row_block& block)
+    {
+        std::unique_lock<std::mutex> lock{ m_mutex };
+        m_cv.wait(lock, [this] { return !m_blocks.empty() || m_finished; });
+        if (m_blocks.empty())
+            return false;
+        block = std::move(m_blocks.front());
+        m_blocks.pop_front();
+        m_cv.notify_all();
+        return true;
+    }
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_finished = true;
+        m_cv.notify_all();
+    }
+
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_cancelled = true;
+        m_cv.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<row_block> m_blocks;
+    size_t m_capacity;
+    bool m_finished{};
+    bool m_cancelled{};
+};
+
+// copies blobs of a message to the target segment by segment and puts ids registered in the batch in their place
+class blob_copier
+{
+public:
+    blob_copier(Firebird::IAttachment* from_att, Firebird::ITransaction* from_tra,
+        Firebird::IAttachment* to_att, Firebird::ITransaction* to_tra, Firebird::IBatch* batch)
+        : m_from_att{ from_att }, m_from_tra{ from_tra }, m_to_att{ to_att }, m_to_tra{ to_tra }, m_batch{ batch }
+    {}
+
+    void copy(unsigned char* message, Firebird::IMessageMetadata* meta, std::vector<unsigned> const& columns)
+    {
+        using namespace Firebird;
+
+        auto& st = status();
+        for (auto c : columns)
+        {
+            if (*reinterpret_cast<short*>(message + meta->getNullOffset(&st, c)))
+                continue;
+
+            auto& id = *reinterpret_cast<ISC_QUAD*>(message + meta->getOffset(&st, c));
+            auto from = make_autodestroy(m_from_att->openBlob(&st, m_from_tra, &id, 0, nullptr));
+            ISC_QUAD copy{};
+            auto to = m_to_att->createBlob(&st, m_to_tra, &copy, 0, nullptr);
+            try
+            {
+                unsigned got = 0;
+                int rc;
+                while ((rc = from->getSegment(&st, static_cast<unsigned>(m_segment.size()), m_segment.data(), &got))
+                    == IStatus::RESULT_OK || rc == IStatus::RESULT_SEGMENT)
+                {
+                    to->putSegment(&st, got, m_segment.data());
+                    bytes += got;
+                }
+                to->close(&st);
+            }
+            catch (...)
+            {
+                // releasing a blob which is not closed cancels it
+                to->release();
+                throw;
+            }
+
+            ++m_user_id.gds_quad_low;
+            m_batch->registerBlob(&st, &copy, &m_user_id);
+            id = m_user_id;
+            ++count;
+        }
+    }
+
+    uint64_t count{};
+    uint64_t bytes{};
+
+private:
+    Firebird::IAttachment* m_from_att;
+    Firebird::ITransaction* m_from_tra;
+    Firebird::IAttachment* m_to_att;
+    Firebird::ITransaction* m_to_tra;
+    Firebird::IBatch* m_batch;
+    ISC_QUAD m_user_id{};
+    std::vector<unsigned char> m_segment = std::vector<unsigned char>(32 * 1024);
+};
+
+// batch of a statement taking up to <rows> messages of the given format at once,
+// blob ids are assigned by blob_copier
+static inline Firebird::IBatch* create_batch(Firebird::IAttachment* att, Firebird::ITransaction* tra, const char* sql,
+    Firebird::IMessageMetadata* meta, unsigned rows, bool blobs)
+{
+    using namespace Firebird;
+
+    static const size_t default_buffer_size = 16 * 1024 * 1024;
+
+    auto& st = status();
+    auto size = static_cast<size_t>(meta->getAlignedLength(&st)) * rows;
+    auto bpb = make_autodestroy(util()->getXpbBuilder(&st, IXpbBuilder::BATCH, nullptr, 0));
+    bpb->insertInt(&st, IBatch::TAG_RECORD_COUNTS, 1);
+    if (size > default_buffer_size)
+        bpb->insertInt(&st, IBatch::TAG_BUFFER_BYTES_SIZE, static_cast<int>(size));
+    if (blobs)
+        bpb->insertInt(&st, IBatch::TAG_BLOB_POLICY, IBatch::BLOB_ID_USER);
+    return att->createBatch(&st, tra, 0, sql, SQL_DIALECT_V6, meta, bpb->getBufferLength(&st), bpb->getBuffer(&st));
+}
+
+// executes the added messages, throws the error of the first failed one
+static inline void execute_batch(Firebird::IBatch* batch, Firebird::ITransaction* tra)
+{
+    using namespace Firebird;
+
+    auto& st = status();
+    auto state = make_autodestroy(batch->execute(&st, tra));
+    auto failed = state->findError(&st, 0);
+    if (failed != IBatchCompletionState::NO_MORE_ERRORS)
+    {
+        auto error = make_autodestroy(master()->getStatus());
+        state->getStatus(&st, &error, failed);
+        throw FbException(&error);
+    }
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Copy the result of a query into a table of another database. A reader thread fetches blocks of rows
+/// while the calling thread inserts the previous ones with batched execution, Firebird 4 and later.
+/// Rows pass in the source message format, the target converts them to its column types.
+/// Blobs are copied segment by segment. The copy is committed when all rows are inserted.
+/// </summary>
+/// <param name="src">- source connection</param>
+/// <param name="src_query">- query over the source database</param>
+/// <param name="dst">- target connection</param>
+/// <param name="dst_table">- target table</param>
+/// <param name="options">- target columns and block sizes, optional</param>
+static inline copy_result copy_table(connection& src, const char* src_query, connection& dst, const char* dst_table,
+    copy_options const& options = {})
+{
+    using namespace Firebird;
+    using namespace _detail;
+
+    auto src_tr = src.start(isolation_level::concurrency(), lock_resolution::wait(), data_access::read_only());
+    auto dst_tr = dst.start();
+    auto src_att = src.handle();
+    auto dst_att = dst.handle();
+
+    copy_result res;
+    try
+    {
+        auto& st = status();
+        auto stmt = make_autodestroy(src_att->prepare(&st, src_tr.handle(), 0, src_query, SQL_DIALECT_V6,
+            IStatement::PREPARE_PREFETCH_METADATA));
+        auto meta = make_autodestroy(stmt->getOutputMetadata(&st));
+        auto count = meta->getCount(&st);
+        auto length = meta->getAlignedLength(&st);
+        if (!options.columns.empty() && options.columns.size() != count)
+            throw logic_error("fbsqlxx::copy_table() - number of columns differs from the query");
+
+        std::vector<unsigned> blob_columns;
+        std::string columns;
+        std::string values;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if ((meta->getType(&st, i) & ~1u) == SQL_BLOB)
+                blob_columns.push_back(i);
+            if (i)
+            {
+                columns += ", ";
+                values += ", ";
+            }
+            columns += options.columns.empty() ? std::string{ meta->getAlias(&st, i) } : options.columns[i];
+            values += "?";
+        }
+
+        auto sql = std::string{ "insert into " } + dst_table + " (" + columns + ") values (" + values + ")";
+        auto block_rows = options.block_rows ? options.block_rows : 1;
+        auto batch = make_autodestroy(create_batch(dst_att, dst_tr.handle(), sql.c_str(), &meta, block_rows,
+            !blob_columns.empty()));
+
+        auto cursor = make_autodestroy(stmt->openCursor(&st, src_tr.handle(), nullptr, nullptr, &meta, 0));
+
+        // the reader owns the cursor, the writer reads blobs of the same source transaction
+        block_queue queue{ options.queue_blocks };
+        std::exception_ptr read_error;
+        std::thread reader{ [&]
+            {
+                try
+                {
+                    try
+                    {
+                        for (;;)
+                        {
+                            row_block block;
+                            block.data.resize(static_cast<size_t>(length) * block_rows);
+                            while (block.count < block_rows
+                                && cursor->fetchNext(&status(), &block.data[static_cast<size_t>(block.count) * length]) == IStatus::RESULT_OK)
+                            {
+                                ++block.count;
+                            }
+                            auto last = block.count < block_rows;
+                            if (block.count && !queue.push(std::move(block)))
+                                break;
+                            if (last)
+                                break;
+                        }
+                    }
+                    catch (const FbException& ex)
+                    {
+                        throw_sql_error(ex);
+                    }
+                }
+                catch (...)
+                {
+                    read_error = std::current_exception();
+                }
+                queue.finish();
+            } };
+
+        blob_copier blobs{ src_att, src_tr.handle(), dst_att, dst_tr.handle(), &batch };
+        try
+        {
+            row_block block;
+            while (queue.pop(block))
+            {
+                for (unsigned r = 0; r < block.count; ++r)
+                    blobs.copy(&block.data[static_cast<size_t>(r) * length], &meta, blob_columns);
+
+                batch->add(&st, block.count, block.data.data());
+                execute_batch(&batch, dst_tr.handle());
+                res.rows += block.count;
+            }
+        }
+        catch (...)
+        {
+            queue.cancel();
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (read_error)
+            std::rethrow_exception(read_error);
+        res.blobs = blobs.count;
+        res.blob_bytes = blobs.bytes;
+    }
+    catch (const FbException& ex)
+    {
+        throw_sql_error(ex);
+    }
+
+    dst_tr.commit();
+    src_tr.commit();
+    return res;
+}
+
+} // namespace fbsqlxx
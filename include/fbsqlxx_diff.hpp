@@ -0,0 +1,363 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_copy.hpp"
+#include "fbsqlxx_schema.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+struct diff_options
+{
+    unsigned fanout{ 16 };          // sub-ranges of a differing range
+    uint64_t leaf_rows{ 2000 };     // ranges with fewer rows are compared row by row
+    unsigned batch_rows{ 1000 };    // rows per upsert and delete batch
+};
+
+struct diff_result
+{
+    uint64_t ranges{};              // key ranges compared by hash
+    uint64_t rows{};                // source rows compared one by one
+    uint64_t inserted{};            // rows missing in the target
+    uint64_t updated{};             // rows differing in the target
+    uint64_t deleted{};             // rows missing in the source
+};
+
+
+namespace _detail {
+
+static inline std::string quote_name(std::string const& name)
+{
+    std::string res = "\"";
+    for (auto c : name)
+    {
+        if (c == '"')
+            res += c;
+        res += c;
+    }
+    return res + "\"";
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Compares a table of two databases by hashes of key ranges and brings the target up to date.
+/// Ranges whose row count or hash sum differ are split until they are small enough to compare
+/// row hashes, only differing rows are transferred. The key must be a single integer column.
+/// </summary>
+class table_diff final
+{
+public:
+    /// <summary>
+    /// Set up the comparison of a table
+    /// </summary>
+    /// <param name="src">- source connection</param>
+    /// <param name="dst">- target connection</param>
+    /// <param name="table">- table from schema_cache, all stored columns are compared</param>
+    /// <param name="key_column">- integer key column</param>
+    /// <param name="options">- range fanout and batch sizes, optional</param>
+    table_diff(connection& src, connection& dst, table_info const& table, const char* key_column,
+        diff_options const& options = {})
+        : m_src{ src }
+        , m_dst{ dst }
+        , m_table{ _detail::quote_name(table.name) }
+        , m_key_name{ _detail::quote_name(key_column) }
+        , m_key{ "cast(" + m_key_name + " as bigint)" }
+        , m_options{ options }
+    {
+        // a row hash of column hashes keeps the text short for wide tables
+        std::string row;
+        for (auto const& c : table.columns)
+        {
+            if (c.computed)
+                continue;
+            auto name = _detail::quote_name(c.name);
+            row += row.empty() ? "" : " || '|' || ";
+            row += "coalesce(cast(hash(" + name + ") as varchar(20)), 'N')";
+            m_columns += (m_columns.empty() ? "" : ", ") + name;
+            m_values += m_values.empty() ? "?" : ", ?";
+        }
+        if (m_columns.empty())
+            throw logic_error("fbsqlxx::table_diff - table has no stored columns");
+        m_hash = "hash(" + row + ")";
+        if (m_options.fanout < 2)
+            m_options.fanout = 2;
+    }
+
+    /// <summary>
+    /// Count differences without changing the target
+    /// </summary>
+    diff_result compare()
+    {
+        return run(false);
+    }
+
+    /// <summary>
+    /// Insert, update and delete target rows to match the source, committed at the end
+    /// </summary>
+    diff_result sync()
+    {
+        return run(true);
+    }
+
+private:
+    struct range
+    {
+        int64_t lo;
+        int64_t hi;                 // inclusive
+        uint64_t rows;
+    };
+
+    struct bucket
+    {
+        int64_t count{};
+        int64_t sum{};
+    };
+
+    std::map<int64_t, bucket> buckets(statement const& st, range const& r, int64_t step) const
+    {
+        std::map<int64_t, bucket> res;
+        auto rs = st.cursor(r.lo, step, r.lo, r.hi);
+        while (rs.next())
+            res[rs.get(0).as<int64_t>()] = { rs.get(1).as<int64_t>(), rs.get(2).as<int64_t>() };
+        rs.close();
+        return res;
+    }
+
+    static bool bounds(transaction& tr, std::string const& sql, int64_t& lo, int64_t& hi, bool& any)
+    {
+        auto rs = tr.cursor(sql.c_str());
+        rs.next();
+        if (!rs.get(0).is_null())
+        {
+            lo = any ? std::min(lo, rs.get(0).as<int64_t>()) : rs.get(0).as<int64_t>();
+            hi = any ? std::max(hi, rs.get(1).as<int64_t>()) : rs.get(1).as<int64_t>();
+            any = true;
+        }
+        rs.close();
+        return any;
+    }
+
+    diff_result run(bool apply)
+    {
+        using namespace Firebird;
+        using namespace _detail;
+
+        auto src_tr = m_src.start(isolation_level::concurrency(), lock_resolution::wait(), data_access::read_only());
+        auto dst_tr = apply ? m_dst.start()
+            : m_dst.start(isolation_level::concurrency(), lock_resolution::wait(), data_access::read_only());
+
+        diff_result res;
+        int64_t lo = 0;
+        int64_t hi = 0;
+        bool any = false;
+        auto minmax = "select cast(min(" + m_key_name + ") as bigint), cast(max(" + m_key_name + ") as bigint) from " + m_table;
+        bounds(src_tr, minmax, lo, hi, any);
+        if (!bounds(dst_tr, minmax, lo, hi, any))
+            return res;
+
+        auto bucket_sql = "select (" + m_key + " - ?) / ?, count(*), cast(sum(mod(" + m_hash + ", 1000000007)) as bigint)"
+            + " from " + m_table + " where " + m_key_name + " between ? and ? group by 1";
+        auto src_buckets = src_tr.prepare(bucket_sql.c_str());
+        auto dst_buckets = dst_tr.prepare(bucket_sql.c_str());
+        auto dst_rows = dst_tr.prepare(("select " + m_key + ", " + m_hash + " from " + m_table
+            + " where " + m_key_name + " between ? and ? order by " + m_key_name).c_str());
+        auto delete_rows = dst_tr.prepare(("delete from " + m_table + " where " + m_key_name + " = ?").c_str());
+
+        try
+        {
+            // source rows keep their message format from the cursor to the upsert batch
+            auto& st = status();
+            auto src_sql = "select " + m_key + ", " + m_hash + ", " + m_columns + " from " + m_table
+                + " where " + m_key_name + " between ? and ? order by " + m_key_name;
+            auto src_rows = make_autodestroy(m_src.handle()->prepare(&st, src_tr.handle(), 0, src_sql.c_str(), SQL_DIALECT_V6,
+                IStatement::PREPARE_PREFETCH_METADATA));
+            auto out = make_autodestroy(src_rows->getOutputMetadata(&st));
+            auto builder = make_autodestroy(out->getBuilder(&st));
+            builder->remove(&st, 0);
+            builder->remove(&st, 0);
+            auto in = make_autodestroy(builder->getMetadata(&st));
+
+            struct field_copy
+            {
+                unsigned from, from_null, to, to_null, length;
+            };
+            std::vector<field_copy> fields;
+            std::vector<unsigned> blob_columns;
+            for (unsigned i = 0; i < in->getCount(&st); ++i)
+            {
+                auto type = in->getType(&st, i) & ~1u;
+                auto length = in->getLength(&st, i) + (type == SQL_VARYING ? sizeof(short) : 0);
+                fields.push_back({ out->getOffset(&st, i + 2), out->getNullOffset(&st, i + 2),
+                    in->getOffset(&st, i), in->getNullOffset(&st, i), static_cast<unsigned>(length) });
+                if (type == SQL_BLOB)
+                    blob_columns.push_back(i);
+            }
+
+            auto batch_rows = m_options.batch_rows ? m_options.batch_rows : 1;
+            IBatch* batch = nullptr;
+            std::unique_ptr<blob_copier> blobs;
+            if (apply)
+            {
+                auto sql = "update or insert into " + m_table + " (" + m_columns + ") values (" + m_values
+                    + ") matching (" + m_key_name + ")";
+                batch = create_batch(m_dst.handle(), dst_tr.handle(), sql.c_str(), &in, batch_rows, !blob_columns.empty());
+                blobs.reset(new blob_copier{ m_src.handle(), src_tr.handle(), m_dst.handle(), dst_tr.handle(), batch });
+            }
+            auto release_batch = make_autodestroy(batch);
+
+            auto length = in->getAlignedLength(&st);
+            std::vector<unsigned char> pending(static_cast<size_t>(length) * batch_rows);
+            unsigned pending_rows = 0;
+            std::vector<std::tuple<int64_t>> pending_deletes;
+
+            // deletes go first, a new row may reuse a unique value of a deleted one
+            auto flush = [&]
+            {
+                if (!pending_deletes.empty())
+                    delete_rows.execute_batch(pending_deletes);
+                pending_deletes.clear();
+                if (pending_rows)
+                {
+                    batch->add(&st, pending_rows, pending.data());
+                    execute_batch(batch, dst_tr.handle());
+                }
+                pending_rows = 0;
+            };
+            auto upsert = [&](const unsigned char* message)
+            {
+                if (!apply)
+                    return;
+                auto to = &pending[static_cast<size_t>(pending_rows) * length];
+                for (auto const& f : fields)
+                {
+                    memcpy(to + f.to_null, message + f.from_null, sizeof(short));
+                    memcpy(to + f.to, message + f.from, f.length);
+                }
+                blobs->copy(to, &in, blob_columns);
+                if (++pending_rows == batch_rows)
+                    flush();
+            };
+            auto remove = [&](int64_t key)
+            {
+                ++res.deleted;
+                if (!apply)
+                    return;
+                pending_deletes.emplace_back(key);
+                if (pending_deletes.size() == batch_rows)
+                    flush();
+            };
+
+            std::vector<range> todo{ { lo, hi, std::numeric_limits<uint64_t>::max() } };
+            std::vector<unsigned char> message(out->getMessageLength(&st));
+            while (!todo.empty())
+            {
+                auto r = todo.back();
+                todo.pop_back();
+
+                if (r.rows > m_options.leaf_rows && r.lo != r.hi)
+                {
+                    auto width = static_cast<uint64_t>(r.hi) - static_cast<uint64_t>(r.lo);
+                    auto step = static_cast<int64_t>(width / m_options.fanout + 1);
+                    auto src_future = std::async(std::launch::async, [&] { return buckets(src_buckets, r, step); });
+                    auto dst = buckets(dst_buckets, r, step);
+                    auto src = src_future.get();
+
+                    std::vector<int64_t> indices;
+                    for (auto const& b : src)
+                        indices.push_back(b.first);
+                    for (auto const& b : dst)
+                    {
+                        if (!src.count(b.first))
+                            indices.push_back(b.first);
+                    }
+                    for (auto i : indices)
+                    {
+                        ++res.ranges;
+                        auto s = src[i];
+                        auto d = dst[i];
+                        if (s.count == d.count && s.sum == d.sum)
+                            continue;
+                        auto sub_lo = static_cast<int64_t>(static_cast<uint64_t>(r.lo) + static_cast<uint64_t>(i) * step);
+                        auto sub_hi = static_cast<uint64_t>(r.hi - sub_lo) < static_cast<uint64_t>(step) ? r.hi : sub_lo + step - 1;
+                        todo.push_back({ sub_lo, sub_hi, static_cast<uint64_t>(std::max(s.count, d.count)) });
+                    }
+                    continue;
+                }
+
+                // leaf: target row hashes in memory, source rows streamed and merged by key
+                std::vector<std::pair<int64_t, int64_t>> target;
+                auto rs = dst_rows.cursor(r.lo, r.hi);
+                while (rs.next())
+                    target.emplace_back(rs.get(0).as<int64_t>(), rs.get(1).as<int64_t>());
+                rs.close();
+
+                input_params params;
+                params.add(r.lo);
+                params.add(r.hi);
+                std::vector<unsigned char> input;
+                auto imeta = make_autodestroy(params.make_input(input, st));
+                auto cursor = make_autodestroy(src_rows->openCursor(&st, src_tr.handle(), &imeta, input.data(), &out, 0));
+
+                size_t t = 0;
+                while (cursor->fetchNext(&st, message.data()) == IStatus::RESULT_OK)
+                {
+                    ++res.rows;
+                    auto key = *reinterpret_cast<int64_t*>(&message[out->getOffset(&st, 0)]);
+                    auto hash = *reinterpret_cast<int64_t*>(&message[out->getOffset(&st, 1)]);
+                    for (; t < target.size() && target[t].first < key; ++t)
+                        remove(target[t].first);
+                    if (t < target.size() && target[t].first == key)
+                    {
+                        if (target[t++].second != hash)
+                        {
+                            ++res.updated;
+                            upsert(message.data());
+                        }
+                    }
+                    else
+                    {
+                        ++res.inserted;
+                        upsert(message.data());
+                    }
+                }
+                for (; t < target.size(); ++t)
+                    remove(target[t].first);
+            }
+            if (apply)
+                flush();
+        }
+        catch (const FbException& ex)
+        {
+            throw_sql_error(ex);
+        }
+
+        if (apply)
+            dst_tr.commit();
+        src_tr.commit();
+        return res;
+    }
+
+private:
+    connection& m_src;
+    connection& m_dst;
+    std::string m_table;
+    std::string m_key_name;
+    std::string m_key;              // the key column cast to bigint, select lists only: filters need the bare column to use its index
+    std::string m_hash;             // row hash expression
+    std::string m_columns;
+    std::string m_values;
+    diff_options m_options;
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Counts postings of a database event (POST_EVENT) without blocking the caller.
+/// The server delivers the event when the posting transaction commits.
+/// </summary>
+class event_watch final
+{
+public:
+    /// <summary>
+    /// Register interest in an event
+    /// </summary>
+    /// <param name="conn">- connection, must outlive the watch</param>
+    /// <param name="name">- event name, up to 255 bytes</param>
+    event_watch(connection const& conn, const char* name)
+        : m_att{ conn.handle() }
+    {
+        std::string n{ name };
+        if (n.empty() || n.size() > 255)
+            throw logic_error("fbsqlxx::event_watch - bad event name");
+
+        // version byte, then the name with its length and a 4-byte count
+        m_epb.push_back(1);
+        m_epb.push_back(static_cast<unsigned char>(n.size()));
+        m_epb.insert(m_epb.end(), n.begin(), n.end());
+        m_epb.resize(m_epb.size() + 4);
+
+        m_callback = new callback;
+        try
+        {
+            queue();
+        }
+        catch (...)
+        {
+            m_callback->release();
+            throw;
+        }
+    }
+
+    ~event_watch()
+    {
+        try
+        {
+            if (m_events)
+            {
+                m_events->cancel(&_detail::status());
+                m_events->release();
+            }
+        }
+        catch (const Firebird::FbException&)
+        {
+        }
+        m_callback->release();
+    }
+
+    event_watch(event_watch const&) = delete;
+    event_watch& operator=(event_watch const&) = delete;
+
+    /// <summary>
+    /// Number of postings since the previous call, zero when none arrived
+    /// </summary>
+    unsigned fired()
+    {
+        std::vector<unsigned char> result;
+        {
+            std::lock_guard<std::mutex> lock{ m_callback->mutex };
+            if (!m_callback->arrived)
+                return 0;
+            m_callback->arrived = false;
+            result = m_callback->result;
+        }
+
+        // the first delivery carries the current count, it is the base for the next ones
+        auto offset = m_epb.size() - 4;
+        unsigned res = 0;
+        if (result.size() >= m_epb.size())
+        {
+            auto before = static_cast<uint32_t>(portable_integer(m_epb.data() + offset, 4));
+            auto after = static_cast<uint32_t>(portable_integer(result.data() + offset, 4));
+            if (m_armed)
+                res = after - before;
+            std::copy(result.begin() + offset, result.begin() + m_epb.size(), m_epb.begin() + offset);
+        }
+        m_armed = true;
+        queue();
+        return res;
+    }
+
+    /// <summary>
+    /// Wait for a posting
+    /// </summary>
+    /// <param name="timeout">- longest wait</param>
+    /// <returns>number of postings, zero on timeout</returns>
+    unsigned wait(std::chrono::milliseconds timeout)
+    {
+        auto until = std::chrono::steady_clock::now() + timeout;
+        for (;;)
+        {
+            if (auto n = fired())
+                return n;
+            std::unique_lock<std::mutex> lock{ m_callback->mutex };
+            if (!m_callback->cv.wait_until(lock, until, [this] { return m_callback->arrived; }))
+                return 0;
+        }
+    }
+
+private:
+    // shared with the client library, which may hold it while the event is queued
+    class callback final : public Firebird::IEventCallbackImpl<callback, Firebird::ThrowStatusWrapper>
+    {
+    public:
+        void addRef()
+        {
+            ++refs;
+        }
+
+        int release()
+        {
+            if (--refs == 0)
+            {
+                delete this;
+                return 0;
+            }
+            return 1;
+        }
+
+        void eventCallbackFunction(unsigned length, const ISC_UCHAR* events)
+        {
+            {
+                std::lock_guard<std::mutex> lock{ mutex };
+                result.assign(events, events + length);
+                arrived = true;
+            }
+            cv.notify_all();
+        }
+
+        std::atomic<int> refs{ 1 };
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<unsigned char> result;
+        bool arrived{};
+    };
+
+    void queue()
+    {
+        try
+        {
+            if (m_events)
+            {
+                m_events->release();
+                m_events = nullptr;
+            }
+            m_events = m_att->queEvents(&_detail::status(), m_callback, static_cast<unsigned>(m_epb.size()), m_epb.data());
+        }
+        catch (const Firebird::FbException& ex)
+        {
+            _detail::throw_sql_error(ex);
+        }
+    }
+
+private:
+    Firebird::IAttachment* m_att;
+    callback* m_callback{};
+    Firebird::IEvents* m_events{};
+    std::vector<unsigned char> m_epb;
+    bool m_armed{};
+};
+
+} // namespace fbsqlxx
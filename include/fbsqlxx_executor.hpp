@@ -0,0 +1,333 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_pool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Runs independent read queries in parallel. Every worker thread owns its own connection,
+/// idle workers steal queued work from busy ones, so long queries don't hold short ones back.
+/// Work of higher priority classes is taken first, within the limits of admission policy.
+/// </summary>
+class query_executor final
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// <summary>
+    /// Attach <paramref name="workers"/> connections and start a thread for each one
+    /// </summary>
+    /// <param name="params">- connection parameters, used by the constructor only</param>
+    /// <param name="workers">- number of worker threads (and connections)</param>
+    /// <param name="policy">- limits of priority classes, optional</param>
+    query_executor(connection_params const& params, unsigned workers = std::thread::hardware_concurrency(),
+        admission_policy const& policy = {})
+        : m_admission{ policy }
+    {
+        if (workers == 0)
+            workers = 1;
+
+        for (unsigned i = 0; i < workers; ++i)
+        {
+            m_connections.push_back(std::make_unique<connection>(params));
+            m_queues.push_back(std::make_unique<worker_queue>());
+        }
+
+        for (unsigned i = 0; i < workers; ++i)
+            m_threads.emplace_back(&query_executor::run, this, i);
+    }
+
+    /// <summary>
+    /// Finish all submitted work, then stop workers and detach connections
+    /// </summary>
+    ~query_executor()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_stop = true;
+        }
+        m_ready.notify_all();
+
+        for (auto& t : m_threads)
+            t.join();
+    }
+
+    query_executor(query_executor const&) = delete;
+    query_executor& operator=(query_executor const&) = delete;
+
+    unsigned size() const
+    {
+        return static_cast<unsigned>(m_threads.size());
+    }
+
+    admission_stats stats(priority p) const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_admission.stats(p);
+    }
+
+    /// <summary>
+    /// Run a function within read-only read committed transaction on some worker
+    /// </summary>
+    /// <param name="func">- callable, takes <em>transaction&amp;</em>, may return a materialized result</param>
+    /// <returns>future of the function result, holds an exception if it throws</returns>
+    template <typename Func>
+    auto submit(Func&& func) -> std::future<std::invoke_result_t<std::decay_t<Func>&, transaction&>>
+    {
+        return submit(priority::normal, std::forward<Func>(func));
+    }
+
+    /// <summary>
+    /// Run a function within read-only read committed transaction on some worker
+    /// </summary>
+    /// <param name="p">- priority class</param>
+    /// <param name="func">- callable, takes <em>transaction&amp;</em>, may return a materialized result</param>
+    /// <param name="d">- deadline of the work, it is shed with rejected_error if it is still queued at this point, optional</param>
+    /// <returns>future of the function result, holds an exception if it throws or is shed</returns>
+    template <typename Func>
+    auto submit(priority p, Func&& func, deadline d = {})
+        -> std::future<std::invoke_result_t<std::decay_t<Func>&, transaction&>>
+    {
+        using result_type = std::invoke_result_t<std::decay_t<Func>&, transaction&>;
+
+        d = _detail::effective(d);
+        auto promise = std::make_shared<std::promise<result_type>>();
+        auto future = promise->get_future();
+        push(p, d.time_point(), [promise, d, func = std::forward<Func>(func)](connection* conn) mutable
+            {
+                try
+                {
+                    if (!conn)
+                        throw rejected_error("query_executor - deadline expired in queue");
+
+                    deadline_scope scope{ d }; // the submitter's budget applies on the worker thread
+                    auto tr = conn->start(isolation_level::read_committed(true), lock_resolution::wait(), data_access::read_only());
+                    if constexpr (std::is_void_v<result_type>)
+                    {
+                        func(tr);
+                        tr.commit();
+                        promise->set_value();
+                    }
+                    else
+                    {
+                        result_type result = func(tr);
+                        tr.commit();
+                        promise->set_value(std::move(result));
+                    }
+                }
+                catch (...)
+                {
+                    promise->set_exception(std::current_exception());
+                }
+            });
+        return future;
+    }
+
+    /// <summary>
+    /// Open a cursor on some worker and pass every fetched row to a callback, on the worker thread
+    /// </summary>
+    /// <param name="sql">- SQL query string</param>
+    /// <param name="on_row">- callable, takes <em>result_set&amp;</em> positioned on the current row</param>
+    /// <param name="args">- query parameters, copied</param>
+    /// <returns>future of fetched rows count</returns>
+    template <typename OnRow, typename ...Args>
+    std::future<size_t> stream(std::string sql, OnRow on_row, Args ...args)
+    {
+        return stream(priority::normal, std::move(sql), std::move(on_row), std::move(args)...);
+    }
+
+    /// <summary>
+    /// Open a cursor on some worker and pass every fetched row to a callback, on the worker thread
+    /// </summary>
+    /// <param name="p">- priority class</param>
+    /// <param name="sql">- SQL query string</param>
+    /// <param name="on_row">- callable, takes <em>result_set&amp;</em> positioned on the current row</param>
+    /// <param name="args">- query parameters, copied</param>
+    /// <returns>future of fetched rows count</returns>
+    template <typename OnRow, typename ...Args>
+    std::future<size_t> stream(priority p, std::string sql, OnRow on_row, Args ...args)
+    {
+        return submit(p, [sql = std::move(sql), on_row = std::move(on_row), params = std::make_tuple(std::move(args)...)](transaction& tr) mutable
+            {
+                auto rs = std::apply([&](auto& ...a) { return tr.cursor(sql.c_str(), a...); }, params);
+                size_t rows = 0;
+                while (rs.next())
+                {
+                    on_row(rs);
+                    ++rows;
+                }
+                rs.close();
+                return rows;
+            });
+    }
+
+private:
+    // receives nullptr when the work is shed
+    using task = std::function<void(connection*)>;
+
+    struct job
+    {
+        task run;
+        clock::time_point queued;
+        clock::time_point deadline;
+    };
+
+    struct worker_queue
+    {
+        std::mutex mutex;
+        std::array<std::deque<job>, priority_count> jobs;
+    };
+
+    void push(priority p, clock::time_point deadline, task&& t)
+    {
+        auto now = clock::now();
+        auto i = m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+        {
+            // the job is counted as queued once it is in the deque, so a waiting worker always finds it
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (m_admission.queue_full(p))
+            {
+                m_admission.rejected(p);
+                throw rejected_error("query_executor - queue is full");
+            }
+            {
+                std::lock_guard<std::mutex> queue_lock{ m_queues[i]->mutex };
+                m_queues[i]->jobs[static_cast<unsigned>(p)].push_back({ std::move(t), now, m_admission.deadline(p, now, deadline) });
+            }
+            m_admission.queued(p);
+        }
+        m_ready.notify_one();
+    }
+
+    // own queue is served first-in first-out, thieves take the newest work from the back
+    bool take(size_t self, priority p, job& j)
+    {
+        auto count = m_queues.size();
+        for (size_t n = 0; n < count; ++n)
+        {
+            auto& q = *m_queues[(self + n) % count];
+            std::lock_guard<std::mutex> lock{ q.mutex };
+            auto& jobs = q.jobs[static_cast<unsigned>(p)];
+            if (jobs.empty())
+                continue;
+
+            if (n == 0)
+            {
+                j = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            else
+            {
+                j = std::move(jobs.back());
+                jobs.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool runnable() const
+    {
+        for (unsigned i = 0; i < priority_count; ++i)
+        {
+            auto p = static_cast<priority>(i);
+            if (m_admission.stats(p).queued > 0 && m_admission.can_run(p))
+                return true;
+        }
+        return false;
+    }
+
+    bool queued() const
+    {
+        for (unsigned i = 0; i < priority_count; ++i)
+            if (m_admission.stats(static_cast<priority>(i)).queued > 0)
+                return true;
+        return false;
+    }
+
+    // runs one job of the highest priority class which is below its limit
+    bool run_one(size_t self, connection& conn)
+    {
+        for (unsigned i = 0; i < priority_count; ++i)
+        {
+            auto p = static_cast<priority>(i);
+            {
+                std::lock_guard<std::mutex> lock{ m_mutex };
+                if (!m_admission.try_start(p))
+                    continue;
+            }
+
+            job j;
+            bool found = take(self, p, j);
+            auto now = clock::now();
+            bool expired = found && j.deadline < now;
+            {
+                std::lock_guard<std::mutex> lock{ m_mutex };
+                if (!found || expired)
+                    m_admission.finished(p);
+                if (expired)
+                    m_admission.shed(p);
+                else if (found)
+                    m_admission.admitted(p, now - j.queued, true);
+            }
+            if (!found)
+                continue;
+
+            j.run(expired ? nullptr : &conn);
+            if (!expired)
+            {
+                {
+                    std::lock_guard<std::mutex> lock{ m_mutex };
+                    m_admission.finished(p);
+                }
+                m_ready.notify_one(); // a class slot is free again
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self)
+    {
+        auto& conn = *m_connections[self];
+        for (;;)
+        {
+            if (run_one(self, conn))
+                continue;
+
+            std::unique_lock<std::mutex> lock{ m_mutex };
+            // on stop, jobs of classes at their limit wait for the running ones to finish
+            m_ready.wait(lock, [this] { return runnable() || (m_stop && !queued()); });
+            if (m_stop && !queued())
+            {
+                m_ready.notify_all(); // other workers waiting for the last jobs leave too
+                break;
+            }
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<connection>> m_connections;
+    std::vector<std::unique_ptr<worker_queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    _detail::admission_state m_admission;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_ready;
+    bool m_stop{};
+    std::atomic<size_t> m_next{};
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,596 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+namespace _detail {
+
+// Key columns are encoded into bytes which compare with memcmp in the order of _detail::compare():
+// a null flag, then big-endian integers with the sign bit flipped, doubles mapped to ordered integers,
+// text with zero bytes escaped and a 0x00 0x00 terminator, CHAR without trailing spaces.
+// Integer and floating point columns compare as 64-bit integers and doubles whatever their width.
+
+static inline void put_ordered(std::string& out, uint64_t value)
+{
+    for (int shift = 56; shift >= 0; shift -= 8)
+        out += static_cast<char>((value >> shift) & 0xFF);
+}
+
+static inline void put_int(std::string& out, int64_t value)
+{
+    put_ordered(out, static_cast<uint64_t>(value) ^ (uint64_t{ 1 } << 63));
+}
+
+static inline void put_i128(std::string& out, uint64_t low, int64_t high)
+{
+    put_int(out, high);
+    put_ordered(out, low);
+}
+
+static inline void put_double(std::string& out, double value)
+{
+    if (value == 0)
+        value = 0;      // -0.0 equals 0.0
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_ordered(out, (bits >> 63) ? ~bits : bits | (uint64_t{ 1 } << 63));
+}
+
+static inline void put_text(std::string& out, const char* data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        out += data[i];
+        if (data[i] == 0)
+            out += '\xFF';
+    }
+    out += '\0';
+    out += '\0';
+}
+
+static inline size_t trimmed(const char* data, size_t length)
+{
+    while (length && data[length - 1] == ' ')
+        --length;
+    return length;
+}
+
+static inline int64_t scale_up(int64_t value, int scale)
+{
+    for (; scale < 0; ++scale)
+        value *= 10;
+    return value;
+}
+
+[[noreturn]] static inline void key_type_mismatch(key_part const& key)
+{
+    std::string msg = "fbsqlxx::index - key value does not match the column type ";
+    msg += type_name(key.type);
+    throw logic_error(msg.data());
+}
+
+// key of a row message
+static inline void encode_key(key_part const& key, const unsigned char* message, std::string& out)
+{
+    if (*reinterpret_cast<const short*>(message + key.null_offset))
+    {
+        out += '\0';
+        return;
+    }
+    out += '\1';
+
+    auto data = message + key.offset;
+    switch (key.type)
+    {
+    case SQL_BOOLEAN:
+        out += static_cast<char>(*data ? 1 : 0);
+        return;
+    case SQL_SHORT:
+        return put_int(out, load<short>(data));
+    case SQL_LONG:
+        return put_int(out, load<int32_t>(data));
+    case SQL_INT64:
+        return put_int(out, load<int64_t>(data));
+    case SQL_INT128:
+        return put_i128(out, load<uint64_t>(data), load<int64_t>(data + sizeof(uint64_t)));
+    case SQL_FLOAT:
+        return put_double(out, load<float>(data));
+    case SQL_DOUBLE:
+        return put_double(out, load<double>(data));
+    case SQL_TYPE_DATE:
+        return put_int(out, load<ISC_DATE>(data));
+    case SQL_TYPE_TIME:
+    case SQL_TIME_TZ:
+        return put_int(out, load<ISC_TIME>(data));
+    case SQL_TIMESTAMP:
+    case SQL_TIMESTAMP_TZ:
+        put_int(out, load<ISC_DATE>(data));
+        return put_int(out, load<ISC_TIME>(data + sizeof(ISC_DATE)));
+    case SQL_TEXT:
+    {
+        auto text = reinterpret_cast<const char*>(data);
+        return put_text(out, text, trimmed(text, key.length));
+    }
+    case SQL_VARYING:
+        return put_text(out, reinterpret_cast<const char*>(data + sizeof(short)), load<unsigned short>(data));
+    default:
+        break;
+    }
+
+    std::string msg = "fbsqlxx::index - column type can not be a key: ";
+    msg += type_name(key.type);
+    throw logic_error(msg.data());
+}
+
+// key of a looked up value, converted to the column type
+static inline void encode_value(key_part const&, std::nullptr_t, std::string& out)
+{
+    out += '\0';
+}
+
+static inline void encode_value(key_part const& key, bool value, std::string& out)
+{
+    if (key.type != SQL_BOOLEAN)
+        key_type_mismatch(key);
+    out += '\1';
+    out += static_cast<char>(value ? 1 : 0);
+}
+
+template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>>
+static inline void encode_value(key_part const& key, T value, std::string& out)
+{
+    out += '\1';
+    switch (key.type)
+    {
+    case SQL_SHORT:
+    case SQL_LONG:
+    case SQL_INT64:
+        if constexpr (std::is_floating_point_v<T>)
+            return put_int(out, std::llround(value * std::pow(10.0, -key.scale)));
+        else
+            return put_int(out, scale_up(static_cast<int64_t>(value), key.scale));
+    case SQL_INT128:
+        if constexpr (std::is_integral_v<T>)
+        {
+            auto v = scale_up(static_cast<int64_t>(value), key.scale);
+            return put_i128(out, static_cast<uint64_t>(v), v < 0 ? -1 : 0);
+        }
+        break;
+    case SQL_FLOAT:
+    case SQL_DOUBLE:
+        return put_double(out, static_cast<double>(value));
+    default:
+        break;
+    }
+    key_type_mismatch(key);
+}
+
+static inline void encode_value(key_part const& key, std::string_view value, std::string& out)
+{
+    if (key.type != SQL_TEXT && key.type != SQL_VARYING)
+        key_type_mismatch(key);
+    out += '\1';
+    auto length = key.type == SQL_TEXT ? trimmed(value.data(), value.size()) : value.size();
+    put_text(out, value.data(), length);
+}
+
+static inline void encode_value(key_part const& key, std::string const& value, std::string& out)
+{
+    encode_value(key, std::string_view{ value }, out);
+}
+
+static inline void encode_value(key_part const& key, const char* value, std::string& out)
+{
+    encode_value(key, std::string_view{ value }, out);
+}
+
+static inline void encode_value(key_part const& key, date const& value, std::string& out)
+{
+    auto d = util()->encodeDate(value.year, value.month, value.day);
+    out += '\1';
+    if (key.type == SQL_TYPE_DATE)
+        return put_int(out, d);
+    if (key.type != SQL_TIMESTAMP && key.type != SQL_TIMESTAMP_TZ)
+        key_type_mismatch(key);
+    put_int(out, d);
+    put_int(out, 0);
+}
+
+static inline void encode_value(key_part const& key, time const& value, std::string& out)
+{
+    if (key.type != SQL_TYPE_TIME && key.type != SQL_TIME_TZ)
+        key_type_mismatch(key);
+    out += '\1';
+    put_int(out, util()->encodeTime(value.hours, value.minutes, value.seconds, value.fractions));
+}
+
+static inline void encode_value(key_part const& key, timestamp const& value, std::string& out)
+{
+    if (key.type != SQL_TIMESTAMP && key.type != SQL_TIMESTAMP_TZ)
+        key_type_mismatch(key);
+    out += '\1';
+    put_int(out, util()->encodeDate(value.date.year, value.date.month, value.date.day));
+    put_int(out, util()->encodeTime(value.time.hours, value.time.minutes, value.time.seconds, value.time.fractions));
+}
+
+static inline std::vector<key_part> make_key_parts(row_table const& table, std::vector<unsigned> const& columns)
+{
+    if (columns.empty())
+        throw logic_error("fbsqlxx::index - no key columns");
+    if (table.size() >= std::numeric_limits<uint32_t>::max())
+        throw logic_error("fbsqlxx::index - too many rows");
+
+    std::vector<key_part> res;
+    for (auto c : columns)
+    {
+        if (c >= table.ncols())
+            throw logic_error("fbsqlxx::index - column index out of bounds");
+        res.push_back(make_key_part(table.metadata(), c));
+    }
+    return res;
+}
+
+template <typename... Keys>
+std::string encode_values(std::vector<key_part> const& keys, Keys const&... values)
+{
+    if (sizeof...(values) > keys.size())
+        throw logic_error("fbsqlxx::index - more values than key columns");
+
+    std::string res;
+    size_t i = 0;
+    (encode_value(keys[i++], values, res), ...);
+    return res;
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Rows of a row_table found by an index, in the order of the index
+/// </summary>
+class index_rows final
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = row;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = row;
+
+        row operator*() const
+        {
+            return (*m_table)[*m_pos];
+        }
+
+        iterator& operator++()
+        {
+            ++m_pos;
+            return *this;
+        }
+
+        bool operator==(iterator const& rhs) const
+        {
+            return m_pos == rhs.m_pos;
+        }
+
+        bool operator!=(iterator const& rhs) const
+        {
+            return m_pos != rhs.m_pos;
+        }
+
+    private:
+        friend class index_rows;
+        iterator(row_table const* table, const uint32_t* pos)
+            : m_table{ table }, m_pos{ pos }
+        {}
+
+        row_table const* m_table;
+        const uint32_t* m_pos;
+    };
+
+    index_rows(row_table const* table, const uint32_t* first, const uint32_t* last)
+        : m_table{ table }, m_first{ first }, m_last{ last }
+    {}
+
+    iterator begin() const { return iterator{ m_table, m_first }; }
+    iterator end() const { return iterator{ m_table, m_last }; }
+    size_t size() const { return static_cast<size_t>(m_last - m_first); }
+    bool empty() const { return m_first == m_last; }
+
+    row operator[](size_t index) const
+    {
+        return (*m_table)[m_first[index]];
+    }
+
+    /// <summary>
+    /// Index of a row in the table
+    /// </summary>
+    size_t position(size_t index) const
+    {
+        return m_first[index];
+    }
+
+private:
+    row_table const* m_table;
+    const uint32_t* m_first;
+    const uint32_t* m_last;
+};
+
+
+/// <summary>
+/// Hash index over key columns of a row_table, for equality lookups. Open addressing over the
+/// distinct keys, the rows of a key are adjacent. The table must outlive the index and not change.
+/// NULL keys are equal to each other and are found with nullptr.
+/// </summary>
+class hash_index final
+{
+public:
+    /// <summary>
+    /// Build the index
+    /// </summary>
+    /// <param name="table">- materialized rows</param>
+    /// <param name="columns">- key columns, counted from zero</param>
+    hash_index(row_table const& table, std::vector<unsigned> const& columns)
+        : m_table{ &table }
+        , m_keys{ _detail::make_key_parts(table, columns) }
+    {
+        auto n = static_cast<uint32_t>(table.size());
+        size_t capacity = 16;
+        while (capacity < size_t{ n } * 2)
+            capacity *= 2;
+        m_slots.assign(capacity, slot{});
+
+        std::vector<std::string> group_keys;
+        std::vector<uint32_t> group_of(n);
+        std::string key;
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            key.clear();
+            encode(i, key);
+            auto h = hash(key);
+            auto& s = m_slots[probe(h, [&](uint32_t g) { return group_keys[g] == key; })];
+            if (s.group == empty_slot)
+            {
+                s = { h, static_cast<uint32_t>(group_keys.size()) };
+                group_keys.push_back(key);
+                m_begin.push_back(0);
+            }
+            group_of[i] = s.group;
+            ++m_begin[s.group];
+        }
+
+        // counts to group offsets, then rows in table order within each group
+        uint32_t total = 0;
+        for (auto& b : m_begin)
+        {
+            auto count = b;
+            b = total;
+            total += count;
+        }
+        m_begin.push_back(total);
+        m_rows.resize(n);
+        std::vector<uint32_t> fill(m_begin.begin(), m_begin.end() - 1);
+        for (uint32_t i = 0; i < n; ++i)
+            m_rows[fill[group_of[i]]++] = i;
+    }
+
+    /// <summary>
+    /// Number of distinct keys
+    /// </summary>
+    size_t keys() const
+    {
+        return m_begin.size() - 1;
+    }
+
+    /// <summary>
+    /// Rows with the key, a value per key column
+    /// </summary>
+    template <typename... Keys>
+    index_rows equal_range(Keys const&... values) const
+    {
+        static_assert(sizeof...(values) > 0, "Key values are required");
+        if (sizeof...(values) != m_keys.size())
+            throw logic_error("fbsqlxx::hash_index - a value per key column is required");
+
+        auto key = _detail::encode_values(m_keys, values...);
+        std::string scratch;
+        auto& s = m_slots[probe(hash(key), [&](uint32_t g)
+            {
+                scratch.clear();
+                encode(m_rows[m_begin[g]], scratch);
+                return scratch == key;
+            })];
+        if (s.group == empty_slot)
+            return { m_table, nullptr, nullptr };
+        return { m_table, m_rows.data() + m_begin[s.group], m_rows.data() + m_begin[s.group + 1] };
+    }
+
+    /// <summary>
+    /// First row with the key
+    /// </summary>
+    template <typename... Keys>
+    std::optional<row> find(Keys const&... values) const
+    {
+        auto rows = equal_range(values...);
+        if (rows.empty())
+            return std::nullopt;
+        return rows[0];
+    }
+
+private:
+    static constexpr uint32_t empty_slot = std::numeric_limits<uint32_t>::max();
+
+    struct slot
+    {
+        uint64_t hash{};
+        uint32_t group{ empty_slot };
+    };
+
+    static uint64_t hash(std::string const& key)
+    {
+        // FNV-1a, then a finalizer to spread it over the low bits
+        uint64_t h = 14695981039346656037ull;
+        for (auto c : key)
+        {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ull;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    void encode(uint32_t index, std::string& out) const
+    {
+        auto data = (*m_table)[index].data();
+        for (auto const& k : m_keys)
+            _detail::encode_key(k, data, out);
+    }
+
+    // slot of the key or the empty slot to put it in
+    template <typename Equal>
+    size_t probe(uint64_t h, Equal equal) const
+    {
+        auto mask = m_slots.size() - 1;
+        for (auto i = static_cast<size_t>(h) & mask;; i = (i + 1) & mask)
+        {
+            auto const& s = m_slots[i];
+            if (s.group == empty_slot || (s.hash == h && equal(s.group)))
+                return i;
+        }
+    }
+
+private:
+    row_table const* m_table;
+    std::vector<_detail::key_part> m_keys;
+    std::vector<slot> m_slots;
+    std::vector<uint32_t> m_begin;      // first position in m_rows of each group, and the end
+    std::vector<uint32_t> m_rows;
+};
+
+
+/// <summary>
+/// Sorted index over key columns of a row_table, for ordered iteration and range lookups.
+/// Lookups may give fewer values than key columns to match a prefix of the key. NULL goes first.
+/// The table must outlive the index and not change.
+/// </summary>
+class sorted_index final
+{
+public:
+    /// <summary>
+    /// Build the index, rows with equal keys keep the table order
+    /// </summary>
+    /// <param name="table">- materialized rows</param>
+    /// <param name="columns">- key columns, counted from zero</param>
+    sorted_index(row_table const& table, std::vector<unsigned> const& columns)
+        : m_table{ &table }
+        , m_keys{ _detail::make_key_parts(table, columns) }
+    {
+        auto n = static_cast<uint32_t>(table.size());
+        std::vector<std::string> keys(n);
+        for (uint32_t i = 0; i < n; ++i)
+            encode(i, m_keys.size(), keys[i]);
+
+        m_rows.resize(n);
+        for (uint32_t i = 0; i < n; ++i)
+            m_rows[i] = i;
+        std::stable_sort(m_rows.begin(), m_rows.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    }
+
+    /// <summary>
+    /// All rows in key order
+    /// </summary>
+    index_rows all() const
+    {
+        return { m_table, m_rows.data(), m_rows.data() + m_rows.size() };
+    }
+
+    /// <summary>
+    /// Rows with the key or key prefix
+    /// </summary>
+    template <typename... Keys>
+    index_rows equal_range(Keys const&... values) const
+    {
+        auto key = _detail::encode_values(m_keys, values...);
+        return { m_table, lower_bound(key, sizeof...(values)), upper_bound(key, sizeof...(values)) };
+    }
+
+    /// <summary>
+    /// First row with the key or key prefix
+    /// </summary>
+    template <typename... Keys>
+    std::optional<row> find(Keys const&... values) const
+    {
+        auto rows = equal_range(values...);
+        if (rows.empty())
+            return std::nullopt;
+        return rows[0];
+    }
+
+    /// <summary>
+    /// Rows with keys from one key to another, both inclusive
+    /// </summary>
+    /// <param name="from">- tuple of the lowest key or key prefix</param>
+    /// <param name="to">- tuple of the highest key or key prefix</param>
+    template <typename... From, typename... To>
+    index_rows range(std::tuple<From...> const& from, std::tuple<To...> const& to) const
+    {
+        auto low = std::apply([this](auto const&... v) { return _detail::encode_values(m_keys, v...); }, from);
+        auto high = std::apply([this](auto const&... v) { return _detail::encode_values(m_keys, v...); }, to);
+        auto first = lower_bound(low, sizeof...(From));
+        auto last = upper_bound(high, sizeof...(To));
+        return { m_table, first, std::max(first, last) };
+    }
+
+private:
+    void encode(uint32_t index, size_t columns, std::string& out) const
+    {
+        auto data = (*m_table)[index].data();
+        for (size_t k = 0; k < columns; ++k)
+            _detail::encode_key(m_keys[k], data, out);
+    }
+
+    const uint32_t* lower_bound(std::string const& key, size_t columns) const
+    {
+        std::string scratch;
+        return std::lower_bound(m_rows.data(), m_rows.data() + m_rows.size(), key, [&](uint32_t r, std::string const& k)
+            {
+                scratch.clear();
+                encode(r, columns, scratch);
+                return scratch < k;
+            });
+    }
+
+    const uint32_t* upper_bound(std::string const& key, size_t columns) const
+    {
+        std::string scratch;
+        return std::upper_bound(m_rows.data(), m_rows.data() + m_rows.size(), key, [&](std::string const& k, uint32_t r)
+            {
+                scratch.clear();
+                encode(r, columns, scratch);
+                return k < scratch;
+            });
+    }
+
+private:
+    row_table const* m_table;
+    std::vector<_detail::key_part> m_keys;
+    std::vector<uint32_t> m_rows;       // table positions in key order
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_service.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Called with every line of the service output
+/// </summary>
+using maintenance_progress = std::function<void(std::string const& line)>;
+
+struct validate_options
+{
+    const char* tables;         // SIMILAR TO pattern of tables to check, all when null
+    const char* skip_tables;    // SIMILAR TO pattern of tables to skip
+    const char* indices;        // SIMILAR TO pattern of indices to check, all when null
+    const char* skip_indices;   // SIMILAR TO pattern of indices to skip
+    int lock_timeout{ 10 };     // seconds to wait for a table lock
+};
+
+
+/// <summary>
+/// Sweep a database: collect garbage below the oldest snapshot and move the oldest interesting
+/// transaction forward
+/// </summary>
+/// <param name="params">- services manager connection parameters</param>
+/// <param name="database">- database path or alias on the server</param>
+/// <param name="parallel_workers">- workers, Firebird 5 and later, server default when zero</param>
+/// <param name="progress">- called with every line of the output, optional</param>
+static inline void sweep(service_params const& params, const char* database, int parallel_workers = 0,
+    maintenance_progress const& progress = {})
+{
+    service svc{ params };
+    service_action action{ isc_action_svc_repair };
+    action.add(isc_spb_dbname, database).add(isc_spb_options, static_cast<int>(isc_spb_rpr_sweep_db));
+    if (parallel_workers > 0)
+    {
+#ifdef isc_spb_rpr_par_workers
+        action.add(isc_spb_rpr_par_workers, parallel_workers);
+#else
+        throw logic_error("fbsqlxx::sweep() - parallel workers need Firebird 5 client headers");
+#endif
+    }
+    svc.start(action);
+    if (progress)
+        svc.read_lines(progress);
+    else
+        svc.wait();
+}
+
+/// <summary>
+/// Validate a database online, without exclusive access. Tables are locked one at a time.
+/// </summary>
+/// <param name="params">- services manager connection parameters</param>
+/// <param name="database">- database path or alias on the server</param>
+/// <param name="options">- what to check</param>
+/// <param name="progress">- called with every line of the report, optional</param>
+/// <returns>number of errors found</returns>
+static inline size_t validate(service_params const& params, const char* database, validate_options const& options = {},
+    maintenance_progress const& progress = {})
+{
+    service svc{ params };
+    service_action action{ isc_action_svc_validate };
+    action.add(isc_spb_dbname, database);
+    if (options.tables)
+        action.add(isc_spb_val_tab_incl, options.tables);
+    if (options.skip_tables)
+        action.add(isc_spb_val_tab_excl, options.skip_tables);
+    if (options.indices)
+        action.add(isc_spb_val_idx_incl, options.indices);
+    if (options.skip_indices)
+        action.add(isc_spb_val_idx_excl, options.skip_indices);
+    action.add(isc_spb_val_lock_timeout, options.lock_timeout);
+    svc.start(action);
+
+    // every checked table ends with "Relation N (NAME) is ok" or "...: N ERRORS found"
+    size_t errors = 0;
+    svc.read_lines([&](std::string const& line)
+        {
+            auto pos = line.find(" ERRORS found");
+            if (pos != std::string::npos)
+            {
+                auto start = line.find_last_not_of("0123456789", pos - 1);
+                start = start == std::string::npos ? 0 : start + 1;
+                if (start < pos)
+                    errors += std::stoul(line.substr(start, pos - start));
+            }
+            if (progress)
+                progress(line);
+        });
+    return errors;
+}
+
+/// <summary>
+/// Recompute selectivity of user indices, so the optimizer sees the current data distribution
+/// </summary>
+/// <param name="conn">- connection</param>
+/// <param name="table">- table name, all tables when null</param>
+/// <param name="progress">- callable, takes <em>std::string const&amp;</em> index name, <em>size_t</em> done and <em>size_t</em> total, optional</param>
+/// <returns>number of indices</returns>
+static inline size_t recompute_index_statistics(connection& conn, const char* table = nullptr,
+    std::function<void(std::string const&, size_t, size_t)> const& progress = {})
+{
+    std::vector<std::string> names;
+    {
+        auto tr = conn.start(isolation_level::read_committed(true), lock_resolution::wait(), data_access::read_only());
+        auto rs = table
+            ? tr.cursor("select trim(rdb$index_name) from rdb$indices "
+                "where coalesce(rdb$system_flag, 0) = 0 and rdb$relation_name = ? order by rdb$index_name", table)
+            : tr.cursor("select trim(rdb$index_name) from rdb$indices "
+                "where coalesce(rdb$system_flag, 0) = 0 order by rdb$relation_name, rdb$index_name");
+        while (rs.next())
+            names.push_back(rs.get(0).as<std::string>());
+        rs.close();
+        tr.commit();
+    }
+
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        std::string sql = "set statistics index \"";
+        for (auto c : names[i])
+        {
+            if (c == '"')
+                sql += c;
+            sql += c;
+        }
+        sql += '"';
+
+        auto tr = conn.start();
+        tr.execute(sql.c_str());
+        tr.commit();
+        if (progress)
+            progress(names[i], i + 1, names.size());
+    }
+    return names.size();
+}
+
+} // namespace fbsqlxx
@@ -0,0 +1,330 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+struct mon_io
+{
+    int64_t reads{};
+    int64_t writes{};
+    int64_t fetches{};
+    int64_t marks{};
+};
+
+struct mon_records
+{
+    int64_t seq_reads{};
+    int64_t idx_reads{};
+    int64_t inserts{};
+    int64_t updates{};
+    int64_t deletes{};
+    int64_t backouts{};
+    int64_t purges{};
+    int64_t expunges{};
+};
+
+struct mon_memory
+{
+    int64_t used{};
+    int64_t allocated{};
+    int64_t max_used{};
+    int64_t max_allocated{};
+};
+
+/// <summary>
+/// Row of MON$ATTACHMENTS with its counters
+/// </summary>
+struct mon_attachment
+{
+    int64_t id{};
+    int64_t server_pid{};
+    int state{};                    // 0 idle, 1 active
+    std::string user;
+    std::string remote_address;
+    std::string remote_process;
+    mon_io io;
+    mon_records records;
+    mon_memory memory;
+};
+
+/// <summary>
+/// Row of MON$STATEMENTS with its counters
+/// </summary>
+struct mon_statement
+{
+    int64_t id{};
+    int64_t attachment_id{};
+    int64_t transaction_id{};       // zero when the statement is not running
+    int state{};                    // 0 idle, 1 active, 2 stalled
+    std::string sql;                // first 8000 bytes
+    mon_io io;
+    mon_records records;
+    mon_memory memory;
+};
+
+enum class mon_metric
+{
+    reads, writes, fetches, marks, seq_reads, idx_reads, inserts, updates, deletes
+};
+
+/// <summary>
+/// Monitoring tables as of one moment
+/// </summary>
+struct monitor_snapshot
+{
+    std::chrono::steady_clock::time_point taken;
+    int64_t own_attachment_id{};    // the collector's attachment
+    std::vector<mon_attachment> attachments;
+    std::vector<mon_statement> statements;
+};
+
+/// <summary>
+/// Rate of a statement's counter between two snapshots
+/// </summary>
+struct mon_statement_rate
+{
+    mon_statement const* statement; // points into the later snapshot
+    int64_t delta{};
+    double per_second{};
+};
+
+
+namespace _detail {
+
+static inline int64_t mon_number(result_set const& rs, unsigned index)
+{
+    auto f = rs.get(index);
+    return f.is_null() ? 0 : f.as<int64_t>();
+}
+
+static inline std::string mon_text(result_set const& rs, unsigned index)
+{
+    auto f = rs.get(index);
+    return f.is_null() ? std::string{} : f.as<std::string>();
+}
+
+static inline int64_t mon_value(mon_statement const& s, mon_metric m)
+{
+    switch (m)
+    {
+    case mon_metric::reads: return s.io.reads;
+    case mon_metric::writes: return s.io.writes;
+    case mon_metric::fetches: return s.io.fetches;
+    case mon_metric::marks: return s.io.marks;
+    case mon_metric::seq_reads: return s.records.seq_reads;
+    case mon_metric::idx_reads: return s.records.idx_reads;
+    case mon_metric::inserts: return s.records.inserts;
+    case mon_metric::updates: return s.records.updates;
+    case mon_metric::deletes: return s.records.deletes;
+    }
+    return 0;
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Reads monitoring tables on its own connection. All tables are read in one read-only
+/// snapshot transaction, so they describe the same moment, with statements prepared once.
+/// Counters are joined on the client, as MON$ tables have no indexes to join them on the server.
+/// </summary>
+class monitor final
+{
+public:
+    /// <summary>
+    /// Attach the collector connection and prepare its queries
+    /// </summary>
+    /// <param name="params">- connection parameters, a user with MON$ access to all attachments for a full picture</param>
+    explicit monitor(connection_params const& params)
+        : m_conn{ params }
+    {
+        auto tr = start();
+        auto rs = tr.cursor("select current_connection from rdb$database");
+        rs.next();
+        m_own_id = rs.get(0).as<int64_t>();
+        rs.close();
+
+        m_queries.emplace_back(tr.prepare(
+            "select mon$attachment_id, mon$server_pid, mon$state, mon$user, mon$remote_address, mon$remote_process, mon$stat_id "
+            "from mon$attachments"));
+        m_queries.emplace_back(tr.prepare(
+            "select mon$statement_id, mon$attachment_id, mon$transaction_id, mon$state, "
+            "cast(left(mon$sql_text, 8000) as varchar(8000)), mon$stat_id "
+            "from mon$statements"));
+        m_queries.emplace_back(tr.prepare(
+            "select mon$stat_id, mon$page_reads, mon$page_writes, mon$page_fetches, mon$page_marks "
+            "from mon$io_stats where mon$stat_group in (1, 3)"));
+        m_queries.emplace_back(tr.prepare(
+            "select mon$stat_id, mon$record_seq_reads, mon$record_idx_reads, mon$record_inserts, mon$record_updates, "
+            "mon$record_deletes, mon$record_backouts, mon$record_purges, mon$record_expunges "
+            "from mon$record_stats where mon$stat_group in (1, 3)"));
+        m_queries.emplace_back(tr.prepare(
+            "select mon$stat_id, mon$memory_used, mon$memory_allocated, mon$max_memory_used, mon$max_memory_allocated "
+            "from mon$memory_usage where mon$stat_group in (1, 3)"));
+        tr.commit();
+    }
+
+    monitor(monitor const&) = delete;
+    monitor& operator=(monitor const&) = delete;
+
+    /// <summary>
+    /// Read the monitoring tables
+    /// </summary>
+    monitor_snapshot take()
+    {
+        using namespace _detail;
+
+        monitor_snapshot res;
+        res.own_attachment_id = m_own_id;
+
+        // counters are keyed by MON$STAT_ID, shared between attachments and statements
+        struct counters
+        {
+            mon_io* io;
+            mon_records* records;
+            mon_memory* memory;
+        };
+        std::unordered_map<int64_t, counters> by_stat;
+
+        auto tr = start();
+        res.taken = std::chrono::steady_clock::now();
+        {
+            auto rs = m_queries[0].rebind(tr).cursor();
+            std::vector<int64_t> stat_ids;
+            while (rs.next())
+            {
+                mon_attachment a;
+                a.id = mon_number(rs, 0);
+                a.server_pid = mon_number(rs, 1);
+                a.state = static_cast<int>(mon_number(rs, 2));
+                a.user = mon_text(rs, 3);
+                a.remote_address = mon_text(rs, 4);
+                a.remote_process = mon_text(rs, 5);
+                stat_ids.push_back(mon_number(rs, 6));
+                res.attachments.push_back(std::move(a));
+            }
+            rs.close();
+            for (size_t i = 0; i < stat_ids.size(); ++i)
+            {
+                auto& a = res.attachments[i];
+                by_stat[stat_ids[i]] = { &a.io, &a.records, &a.memory };
+            }
+        }
+        {
+            auto rs = m_queries[1].rebind(tr).cursor();
+            std::vector<int64_t> stat_ids;
+            while (rs.next())
+            {
+                mon_statement s;
+                s.id = mon_number(rs, 0);
+                s.attachment_id = mon_number(rs, 1);
+                s.transaction_id = mon_number(rs, 2);
+                s.state = static_cast<int>(mon_number(rs, 3));
+                s.sql = mon_text(rs, 4);
+                stat_ids.push_back(mon_number(rs, 5));
+                res.statements.push_back(std::move(s));
+            }
+            rs.close();
+            for (size_t i = 0; i < stat_ids.size(); ++i)
+            {
+                auto& s = res.statements[i];
+                by_stat[stat_ids[i]] = { &s.io, &s.records, &s.memory };
+            }
+        }
+        {
+            auto rs = m_queries[2].rebind(tr).cursor();
+            while (rs.next())
+            {
+                auto it = by_stat.find(mon_number(rs, 0));
+                if (it != by_stat.end())
+                    *it->second.io = { mon_number(rs, 1), mon_number(rs, 2), mon_number(rs, 3), mon_number(rs, 4) };
+            }
+            rs.close();
+        }
+        {
+            auto rs = m_queries[3].rebind(tr).cursor();
+            while (rs.next())
+            {
+                auto it = by_stat.find(mon_number(rs, 0));
+                if (it != by_stat.end())
+                {
+                    *it->second.records = { mon_number(rs, 1), mon_number(rs, 2), mon_number(rs, 3), mon_number(rs, 4),
+                        mon_number(rs, 5), mon_number(rs, 6), mon_number(rs, 7), mon_number(rs, 8) };
+                }
+            }
+            rs.close();
+        }
+        {
+            auto rs = m_queries[4].rebind(tr).cursor();
+            while (rs.next())
+            {
+                auto it = by_stat.find(mon_number(rs, 0));
+                if (it != by_stat.end())
+                    *it->second.memory = { mon_number(rs, 1), mon_number(rs, 2), mon_number(rs, 3), mon_number(rs, 4) };
+            }
+            rs.close();
+        }
+        tr.commit();
+        return res;
+    }
+
+    /// <summary>
+    /// Statements with the highest growth of a counter between two snapshots, per second.
+    /// Statements are matched by attachment and statement id, new ones count from zero.
+    /// </summary>
+    /// <param name="before">- earlier snapshot</param>
+    /// <param name="after">- later snapshot, the result points into it</param>
+    /// <param name="n">- number of statements</param>
+    /// <param name="by">- counter</param>
+    static std::vector<mon_statement_rate> top_statements(monitor_snapshot const& before, monitor_snapshot const& after,
+        size_t n, mon_metric by = mon_metric::fetches)
+    {
+        auto key = [](mon_statement const& s) { return std::make_pair(s.attachment_id, s.id); };
+        std::vector<std::pair<std::pair<int64_t, int64_t>, int64_t>> earlier;
+        earlier.reserve(before.statements.size());
+        for (auto const& s : before.statements)
+            earlier.emplace_back(key(s), _detail::mon_value(s, by));
+        std::sort(earlier.begin(), earlier.end());
+
+        double seconds = std::chrono::duration<double>(after.taken - before.taken).count();
+        std::vector<mon_statement_rate> res;
+        for (auto const& s : after.statements)
+        {
+            auto k = key(s);
+            auto it = std::lower_bound(earlier.begin(), earlier.end(), std::make_pair(k, std::numeric_limits<int64_t>::min()));
+            auto delta = _detail::mon_value(s, by);
+            if (it != earlier.end() && it->first == k)
+                delta -= it->second;
+            if (delta > 0)
+                res.push_back({ &s, delta, seconds > 0 ? delta / seconds : 0 });
+        }
+
+        auto count = std::min(n, res.size());
+        std::partial_sort(res.begin(), res.begin() + count, res.end(),
+            [](mon_statement_rate const& a, mon_statement_rate const& b) { return a.delta > b.delta; });
+        res.resize(count);
+        return res;
+    }
+
+private:
+    transaction start()
+    {
+        return m_conn.start(isolation_level::concurrency(), lock_resolution::wait(), data_access::read_only());
+    }
+
+private:
+    connection m_conn;
+    std::vector<statement> m_queries;
+    int64_t m_own_id{};
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_service.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Row of RDB$BACKUP_HISTORY, one nbackup file
+/// </summary>
+struct nbackup_file
+{
+    int64_t backup_id{};
+    timestamp time{};
+    int level{};
+    std::string guid;
+    int64_t scn{};
+    std::string file_name;      // on the server
+    std::string base_guid;      // base of a backup made by GUID, RDB$BACKUP_HISTORY does not keep it
+};
+
+struct nbackup_options
+{
+    bool no_triggers{};         // don't fire database triggers
+    int direct_io{ -1 };        // -1 leaves the server default, 0 turns direct I/O off, 1 on
+};
+
+
+namespace _detail {
+
+static inline void add_nbackup_options(service_action& action, nbackup_options const& options)
+{
+    if (options.no_triggers)
+        action.add(isc_spb_options, static_cast<int>(isc_spb_nbk_no_triggers));
+    if (options.direct_io >= 0)
+        action.add(isc_spb_nbk_direct, options.direct_io ? "ON" : "OFF");
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Make a physical backup of the given level: 0 is a full copy, level N holds the pages
+/// changed since the last backup of level N-1
+/// </summary>
+/// <param name="params">- services manager connection parameters</param>
+/// <param name="database">- database path or alias on the server</param>
+/// <param name="file">- backup file on the server</param>
+/// <param name="level">- backup level</param>
+/// <param name="options">- backup options, optional</param>
+static inline void nbackup(service_params const& params, const char* database, const char* file, int level,
+    nbackup_options const& options = {})
+{
+    service svc{ params };
+    service_action action{ isc_action_svc_nbak };
+    action.add(isc_spb_dbname, database).add(isc_spb_nbk_file, file).add(isc_spb_nbk_level, level);
+    _detail::add_nbackup_options(action, options);
+    svc.start(action);
+    svc.wait();
+}
+
+/// <summary>
+/// Make an incremental backup of the pages changed since the backup with the given GUID,
+/// Firebird 4 and later
+/// </summary>
+/// <param name="params">- services manager connection parameters</param>
+/// <param name="database">- database path or alias on the server</param>
+/// <param name="file">- backup file on the server</param>
+/// <param name="base_guid">- RDB$GUID of the base backup, see nbackup_history()</param>
+/// <param name="options">- backup options, optional</param>
+static inline void nbackup(service_params const& params, const char* database, const char* file,
+    std::string const& base_guid, nbackup_options const& options = {})
+{
+    service svc{ params };
+    service_action action{ isc_action_svc_nbak };
+    action.add(isc_spb_dbname, database).add(isc_spb_nbk_file, file).add(isc_spb_nbk_guid, base_guid);
+    _detail::add_nbackup_options(action, options);
+    svc.start(action);
+    svc.wait();
+}
+
+/// <summary>
+/// All backups recorded in the database, oldest first
+/// </summary>
+static inline std::vector<nbackup_file> nbackup_history(connection& conn)
+{
+    std::vector<nbackup_file> res;
+    auto tr = conn.start(isolation_level::read_committed(true), lock_resolution::wait(), data_access::read_only());
+    auto rs = tr.cursor("select rdb$backup_id, rdb$timestamp, rdb$backup_level, rdb$guid, rdb$scn, rdb$file_name "
+        "from rdb$backup_history order by rdb$backup_id");
+    while (rs.next())
+    {
+        nbackup_file f;
+        f.backup_id = rs.get(0).as<int64_t>();
+        f.time = rs.get(1).as<timestamp>();
+        f.level = rs.get(2).as<int>();
+        f.guid = rs.get(3).as<std::string>();
+        f.scn = rs.get(4).as<int64_t>();
+        f.file_name = rs.get(5).as<std::string>();
+        res.push_back(std::move(f));
+    }
+    rs.close();
+    tr.commit();
+    return res;
+}
+
+/// <summary>
+/// Files needed to restore a backup, from its level 0 base to the backup itself. A backup is based on
+/// the backup with its base_guid when it is set, otherwise on the latest backup of the level below made
+/// before it. The server does not record the base of backups made by GUID, set base_guid of those
+/// from your own records, or the chain may take a wrong base.
+/// </summary>
+/// <param name="history">- backups from nbackup_history()</param>
+/// <param name="backup_id">- the backup to restore, the latest one when zero</param>
+/// <returns>backup files in restore order</returns>
+static inline std::vector<nbackup_file> nbackup_chain(std::vector<nbackup_file> const& history, int64_t backup_id = 0)
+{
+    if (history.empty())
+        throw logic_error("fbsqlxx::nbackup_chain() - backup history is empty");
+
+    auto it = history.end() - 1;
+    if (backup_id)
+    {
+        it = std::find_if(history.begin(), history.end(), [backup_id](nbackup_file const& f) { return f.backup_id == backup_id; });
+        if (it == history.end())
+            throw logic_error("fbsqlxx::nbackup_chain() - backup is not found");
+    }
+
+    // a level N backup is based on the latest level N-1 backup made before it, unless it was made by GUID
+    std::vector<nbackup_file> res{ *it };
+    while (it->level > 0)
+    {
+        if (!it->base_guid.empty())
+        {
+            auto guid = it->base_guid;
+            auto base = std::find_if(history.begin(), it, [&guid](nbackup_file const& f) { return f.guid == guid; });
+            if (base == it)
+                throw logic_error("fbsqlxx::nbackup_chain() - base backup is not found");
+            it = base;
+        }
+        else
+        {
+            auto level = it->level - 1;
+            auto base = std::find_if(std::make_reverse_iterator(it), history.rend(),
+                [level](nbackup_file const& f) { return f.level == level; });
+            if (base == history.rend())
+                throw logic_error("fbsqlxx::nbackup_chain() - backup chain is broken");
+            it = std::prev(base.base());
+        }
+        res.insert(res.begin(), *it);
+    }
+    return res;
+}
+
+/// <summary>
+/// Copy backup files to a directory, several files at once.
+/// Works when the files are reachable from this process, e.g. with an embedded server.
+/// </summary>
+/// <param name="chain">- backup files, e.g. from nbackup_chain()</param>
+/// <param name="directory">- target directory</param>
+/// <param name="threads">- number of files copied at once</param>
+/// <returns>the chain with file names in the target directory</returns>
+static inline std::vector<nbackup_file> copy_chain(std::vector<nbackup_file> chain, std::string const& directory,
+    unsigned threads = 4)
+{
+    namespace fs = std::filesystem;
+
+    std::atomic<size_t> next{};
+    std::exception_ptr error;
+    std::mutex mutex;
+    auto copy = [&]
+    {
+        for (auto i = next++; i < chain.size(); i = next++)
+        {
+            try
+            {
+                fs::path from{ chain[i].file_name };
+                auto to = fs::path{ directory } / from.filename();
+                fs::copy_file(from, to, fs::copy_options::overwrite_existing);
+                chain[i].file_name = to.string();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock{ mutex };
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto count = std::min<size_t>(threads ? threads : 1, chain.size());
+    for (size_t i = 1; i < count; ++i)
+        workers.emplace_back(copy);
+    copy();
+    for (auto& t : workers)
+        t.join();
+
+    if (error)
+        std::rethrow_exception(error);
+    return chain;
+}
+
+/// <summary>
+/// Restore a database from a backup chain
+/// </summary>
+/// <param name="params">- services manager connection parameters</param>
+/// <param name="chain">- backup files in restore order, level 0 first</param>
+/// <param name="database">- database file to create on the server</param>
+/// <param name="in_place">- apply the increments to an existing database instead, Firebird 4 and later</param>
+static inline void nrestore(service_params const& params, std::vector<nbackup_file> const& chain, const char* database,
+    bool in_place = false)
+{
+    if (chain.empty())
+        throw logic_error("fbsqlxx::nrestore() - backup chain is empty");
+
+    service svc{ params };
+    service_action action{ isc_action_svc_nrest };
+    action.add(isc_spb_dbname, database);
+    for (auto const& f : chain)
+        action.add(isc_spb_nbk_file, f.file_name);
+    if (in_place)
+        action.add(isc_spb_options, static_cast<int>(isc_spb_nbk_inplace));
+    svc.start(action);
+    svc.wait();
+}
+
+} // namespace fbsqlxx
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <chrono>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Plan known for an SQL text
+/// </summary>
+struct plan_record
+{
+    uint64_t hash{};
+    std::string sql;
+    std::string plan;
+    std::string previous_plan;  // plan before the last change, empty if it never changed
+    uint64_t changes{};
+    std::chrono::system_clock::time_point recorded;
+    std::chrono::system_clock::time_point changed;
+};
+
+enum class plan_status
+{
+    first_seen, unchanged, changed
+};
+
+
+namespace _detail {
+
+// FNV-1a, stable between processes and builds unlike std::hash
+static inline uint64_t sql_hash(std::string const& sql)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : sql)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static inline void write_field(std::ostream& os, std::string const& value)
+{
+    os << value.size() << ':' << value << '\n';
+}
+
+static inline bool read_field(std::istream& is, std::string& value)
+{
+    size_t length;
+    char colon;
+    if (!(is >> length) || !is.get(colon) || colon != ':')
+        return false;
+    value.resize(length);
+    if (!is.read(&value[0], static_cast<std::streamsize>(length)))
+        return false;
+    return is.get() == '\n';
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Remembers the plan of every SQL text the first time it is prepared and reports when
+/// a later prepare gets a different one, e.g. after a deploy or a statistics update.
+/// Save the registry and load it on start to compare plans across restarts.
+/// </summary>
+class plan_registry final
+{
+public:
+    using on_change_func = std::function<void(plan_record const&)>;
+
+    /// <summary>
+    /// Create a registry
+    /// </summary>
+    /// <param name="on_change">- called on every plan change, outside the registry lock, optional</param>
+    /// <param name="detailed">- keep explained plans instead of one-line ones</param>
+    explicit plan_registry(on_change_func on_change = {}, bool detailed = false)
+        : m_on_change{ std::move(on_change) }, m_detailed{ detailed }
+    {}
+
+    plan_registry(plan_registry const&) = delete;
+    plan_registry& operator=(plan_registry const&) = delete;
+
+    /// <summary>
+    /// Prepare a statement and record its plan
+    /// </summary>
+    /// <param name="tra">- transaction to prepare the statement in</param>
+    /// <param name="sql">- SQL statement string</param>
+    /// <returns>prepared statement</returns>
+    statement prepare(transaction const& tra, const char* sql)
+    {
+        auto st = tra.prepare(sql);
+        record(sql, st.plan(m_detailed));
+        return st;
+    }
+
+    /// <summary>
+    /// Record the plan of an SQL text
+    /// </summary>
+    /// <returns>whether the plan is new, the same as recorded or different</returns>
+    plan_status record(std::string const& sql, std::string const& plan)
+    {
+        auto hash = _detail::sql_hash(sql);
+        auto now = std::chrono::system_clock::now();
+        plan_record changed;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            auto it = find(hash, sql);
+            if (it == m_plans.end())
+            {
+                m_plans.emplace(hash, plan_record{ hash, sql, plan, {}, 0, now, now });
+                return plan_status::first_seen;
+            }
+
+            auto& r = it->second;
+            if (r.plan == plan)
+                return plan_status::unchanged;
+
+            r.previous_plan = std::move(r.plan);
+            r.plan = plan;
+            ++r.changes;
+            r.changed = now;
+            changed = r;
+        }
+
+        if (m_on_change)
+            m_on_change(changed);
+        return plan_status::changed;
+    }
+
+    /// <summary>
+    /// Plans which changed at least once
+    /// </summary>
+    std::vector<plan_record> changed() const
+    {
+        std::vector<plan_record> res;
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        for (auto const& p : m_plans)
+            if (p.second.changes)
+                res.push_back(p.second);
+        return res;
+    }
+
+    std::vector<plan_record> all() const
+    {
+        std::vector<plan_record> res;
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        for (auto const& p : m_plans)
+            res.push_back(p.second);
+        return res;
+    }
+
+    /// <summary>
+    /// Write SQL texts and their current plans
+    /// </summary>
+    void save(std::ostream& os) const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        for (auto const& p : m_plans)
+        {
+            _detail::write_field(os, p.second.sql);
+            _detail::write_field(os, p.second.plan);
+        }
+    }
+
+    /// <summary>
+    /// Read plans written by save(), they become the baseline for later records
+    /// </summary>
+    void load(std::istream& is)
+    {
+        auto now = std::chrono::system_clock::now();
+        std::string sql, plan;
+        while (_detail::read_field(is, sql))
+        {
+            if (!_detail::read_field(is, plan))
+                throw logic_error("plan_registry::load() - broken input");
+
+            auto hash = _detail::sql_hash(sql);
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            auto it = find(hash, sql);
+            if (it == m_plans.end())
+                m_plans.emplace(hash, plan_record{ hash, sql, plan, {}, 0, now, now });
+            else
+                it->second = plan_record{ hash, sql, plan, {}, 0, now, now };
+        }
+    }
+
+private:
+    using plan_map = std::unordered_multimap<uint64_t, plan_record>;
+
+    // different texts may share a hash, the text itself tells them apart
+    plan_map::iterator find(uint64_t hash, std::string const& sql)
+    {
+        auto range = m_plans.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second.sql == sql)
+                return it;
+        return m_plans.end();
+    }
+
+private:
+    on_change_func m_on_change;
+    bool m_detailed;
+    plan_map m_plans;
+    mutable std::mutex m_mutex;
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,703 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+class rejected_error : public error
+{
+public:
+    rejected_error(const char* msg)
+        : error(msg)
+    {}
+};
+
+
+// admission control, shared by connection_pool and query_executor
+enum class priority : unsigned
+{
+    interactive, normal, bulk
+};
+
+static constexpr unsigned priority_count = 3;
+
+/// <summary>
+/// Limits of one priority class, zero means unlimited
+/// </summary>
+struct admission_limits
+{
+    unsigned max_running{};                 // concurrently running requests of the class
+    size_t max_queued{};                    // requests waiting in the queue, more are rejected at once
+    std::chrono::milliseconds max_wait{};   // requests waiting longer are shed
+};
+
+struct admission_policy
+{
+    std::array<admission_limits, priority_count> classes{};
+
+    admission_limits& operator[](priority p)
+    {
+        return classes[static_cast<unsigned>(p)];
+    }
+
+    admission_limits const& operator[](priority p) const
+    {
+        return classes[static_cast<unsigned>(p)];
+    }
+};
+
+struct admission_stats
+{
+    uint64_t admitted{};
+    uint64_t rejected{};                    // queue depth cap reached
+    uint64_t shed{};                        // deadline expired while queued
+    size_t queued{};
+    size_t running{};
+    std::chrono::nanoseconds total_wait{};  // queue wait of admitted requests
+    std::chrono::nanoseconds max_wait{};
+};
+
+
+namespace _detail {
+
+// book-keeping of admission decisions, callers serialize access with their own mutex
+class admission_state
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    admission_state(admission_policy const& policy)
+        : m_policy{ policy }
+    {}
+
+    bool can_run(priority p) const
+    {
+        auto limit = m_policy[p].max_running;
+        return limit == 0 || at(p).running < limit;
+    }
+
+    bool queue_full(priority p) const
+    {
+        auto limit = m_policy[p].max_queued;
+        return limit != 0 && at(p).queued >= limit;
+    }
+
+    // the earliest of the caller's deadline and the class wait limit
+    clock::time_point deadline(priority p, clock::time_point now, clock::time_point requested) const
+    {
+        auto max_wait = m_policy[p].max_wait;
+        if (max_wait.count() > 0 && now + max_wait < requested)
+            return now + max_wait;
+        return requested;
+    }
+
+    // takes a running slot of the class if it is below the limit
+    bool try_start(priority p)
+    {
+        if (!can_run(p))
+            return false;
+        ++at(p).running;
+        return true;
+    }
+
+    void queued(priority p)
+    {
+        ++at(p).queued;
+    }
+
+    void admitted(priority p, clock::duration wait, bool from_queue)
+    {
+        auto& s = at(p);
+        if (from_queue)
+            --s.queued;
+        ++s.admitted;
+        s.total_wait += wait;
+        if (s.max_wait < wait)
+            s.max_wait = wait;
+    }
+
+    void rejected(priority p)
+    {
+        ++at(p).rejected;
+    }
+
+    void shed(priority p)
+    {
+        auto& s = at(p);
+        --s.queued;
+        ++s.shed;
+    }
+
+    void finished(priority p)
+    {
+        --at(p).running;
+    }
+
+    admission_stats const& stats(priority p) const
+    {
+        return at(p);
+    }
+
+private:
+    admission_stats& at(priority p)
+    {
+        return m_stats[static_cast<unsigned>(p)];
+    }
+
+    admission_stats const& at(priority p) const
+    {
+        return m_stats[static_cast<unsigned>(p)];
+    }
+
+private:
+    admission_policy m_policy;
+    std::array<admission_stats, priority_count> m_stats{};
+};
+
+} // namespace _detail
+
+
+class connection_pool;
+
+/// <summary>
+/// Connection checked out from a pool, it is returned back on destruction
+/// </summary>
+class pooled_connection final
+{
+public:
+    pooled_connection(pooled_connection const&) = delete;
+    pooled_connection& operator=(pooled_connection const&) = delete;
+    pooled_connection& operator=(pooled_connection&&) = delete;
+
+    pooled_connection(pooled_connection&& rhs) noexcept
+        : m_pool{ rhs.m_pool }, m_conn{ rhs.m_conn }, m_priority{ rhs.m_priority }
+    {
+        rhs.m_conn = nullptr;
+    }
+
+    inline ~pooled_connection();
+
+    connection& operator*() const { return *m_conn; }
+    connection* operator->() const { return m_conn; }
+
+    /// <summary>
+    /// Replace a broken connection with a new attachment to the same database
+    /// </summary>
+    inline void reattach();
+
+private:
+    friend class connection_pool;
+    pooled_connection(connection_pool* pool, connection* conn, priority p)
+        : m_pool{ pool }, m_conn{ conn }, m_priority{ p }
+    {}
+
+private:
+    connection_pool* m_pool;
+    connection* m_conn;
+    priority m_priority;
+};
+
+/// <summary>
+/// Fixed set of connections shared by priority classes. A freed connection goes to the
+/// highest priority waiter whose class is below its concurrency limit.
+/// </summary>
+class connection_pool final
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// <summary>
+    /// Attach <paramref name="size"/> connections
+    /// </summary>
+    /// <param name="params">- connection parameters, used by the constructor only</param>
+    /// <param name="size">- number of connections</param>
+    /// <param name="policy">- limits of priority classes, optional</param>
+    connection_pool(connection_params const& params, unsigned size, admission_policy const& policy = {})
+        : m_params{ params }, m_admission{ policy }
+    {
+        for (unsigned i = 0; i < size; ++i)
+        {
+            m_connections.push_back(std::make_unique<connection>(params));
+            m_idle.push_back(m_connections.back().get());
+        }
+    }
+
+    connection_pool(connection_pool const&) = delete;
+    connection_pool& operator=(connection_pool const&) = delete;
+
+    /// <summary>
+    /// Take a connection, wait for it if necessary
+    /// </summary>
+    /// <param name="p">- priority class of the request</param>
+    /// <param name="d">- give up waiting at this point, combined with the scoped deadline, optional</param>
+    /// <returns>connection lease</returns>
+    pooled_connection checkout(priority p = priority::normal, deadline d = {})
+    {
+        auto now = clock::now();
+        std::unique_lock<std::mutex> lock{ m_mutex };
+
+        if (!m_idle.empty() && !has_waiters(p) && m_admission.try_start(p))
+        {
+            m_admission.admitted(p, {}, false);
+            return lease(p);
+        }
+
+        if (m_admission.queue_full(p))
+        {
+            m_admission.rejected(p);
+            throw rejected_error("connection_pool::checkout() - queue is full");
+        }
+
+        waiter w{ {}, nullptr, now };
+        auto& queue = m_waiters[static_cast<unsigned>(p)];
+        queue.push_back(&w);
+        m_admission.queued(p);
+
+        auto until = m_admission.deadline(p, now, _detail::effective(d).time_point());
+        auto granted = [&w] { return w.conn != nullptr; };
+        if (until == clock::time_point::max())
+            w.cv.wait(lock, granted);
+        else if (!w.cv.wait_until(lock, until, granted))
+        {
+            queue.erase(std::find(queue.begin(), queue.end(), &w));
+            m_admission.shed(p);
+            throw rejected_error("connection_pool::checkout() - deadline expired in queue");
+        }
+
+        return pooled_connection{ this, w.conn, p };
+    }
+
+    /// <summary>
+    /// Take an idle connection without waiting
+    /// </summary>
+    /// <param name="p">- priority class of the request</param>
+    /// <returns>connection lease, empty when no connection is idle or the class is at its limit</returns>
+    std::optional<pooled_connection> try_checkout(priority p = priority::normal)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        if (m_idle.empty() || has_waiters(p) || !m_admission.try_start(p))
+            return std::nullopt;
+        m_admission.admitted(p, {}, false);
+        return lease(p);
+    }
+
+    admission_stats stats(priority p) const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_admission.stats(p);
+    }
+
+    unsigned size() const
+    {
+        return static_cast<unsigned>(m_connections.size());
+    }
+
+private:
+    friend class pooled_connection;
+
+    struct waiter
+    {
+        std::condition_variable cv;
+        connection* conn;
+        clock::time_point since;
+    };
+
+    bool has_waiters(priority p) const
+    {
+        for (unsigned i = 0; i <= static_cast<unsigned>(p); ++i)
+            if (!m_waiters[i].empty() && m_admission.can_run(static_cast<priority>(i)))
+                return true;
+        return false;
+    }
+
+    pooled_connection lease(priority p)
+    {
+        auto conn = m_idle.back();
+        m_idle.pop_back();
+        return pooled_connection{ this, conn, p };
+    }
+
+    connection* reattach(connection* conn)
+    {
+        auto fresh = std::make_unique<connection>(m_params.get());
+        std::unique_ptr<connection> old;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (auto& slot : m_connections)
+            {
+                if (slot.get() == conn)
+                {
+                    old = std::move(slot);
+                    slot = std::move(fresh);
+                    return slot.get();
+                }
+            }
+        }
+        throw logic_error("connection_pool::reattach() - connection does not belong to the pool");
+    }
+
+    void release(connection* conn, priority p)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_admission.finished(p);
+        m_idle.push_back(conn);
+
+        // hand idle connections over to waiters, the highest priority first
+        for (unsigned i = 0; i < priority_count && !m_idle.empty(); ++i)
+        {
+            auto& queue = m_waiters[i];
+            while (!queue.empty() && !m_idle.empty() && m_admission.try_start(static_cast<priority>(i)))
+            {
+                auto w = queue.front();
+                queue.pop_front();
+                w->conn = m_idle.back();
+                m_idle.pop_back();
+                m_admission.admitted(static_cast<priority>(i), clock::now() - w->since, true);
+                w->cv.notify_one();
+            }
+        }
+    }
+
+private:
+    _detail::params_holder m_params;
+    std::vector<std::unique_ptr<connection>> m_connections;
+    std::vector<connection*> m_idle;
+    std::array<std::deque<waiter*>, priority_count> m_waiters;
+    _detail::admission_state m_admission;
+    mutable std::mutex m_mutex;
+};
+
+inline pooled_connection::~pooled_connection()
+{
+    if (m_conn)
+        m_pool->release(m_conn, m_priority);
+}
+
+inline void pooled_connection::reattach()
+{
+    m_conn = m_pool->reattach(m_conn);
+}
+
+
+/// <summary>
+/// Replica lag checks and failure handling of routing_pool
+/// </summary>
+struct replica_policy
+{
+    const char* lag_query{};                        // returns replica lag in seconds, one row one column, optional
+    std::chrono::seconds max_lag{ 30 };             // replicas lagging more are skipped
+    std::chrono::seconds check_interval{ 5 };       // lag is queried again after this time
+    std::chrono::seconds retry_after{ 10 };         // failed replicas are tried again after this time
+};
+
+struct target_health
+{
+    bool healthy{ true };
+    double lag{};                                   // seconds, as of the last check
+    uint64_t routed{};                              // transactions started on the target
+    uint64_t failures{};
+};
+
+/// <summary>
+/// Transaction started by routing_pool, holds its connection until destruction
+/// </summary>
+class pooled_transaction final
+{
+public:
+    pooled_transaction(pooled_transaction&&) = default;
+    pooled_transaction(pooled_transaction const&) = delete;
+    pooled_transaction& operator=(pooled_transaction const&) = delete;
+    pooled_transaction& operator=(pooled_transaction&&) = delete;
+
+    transaction& operator*() { return m_tra; }
+    transaction* operator->() { return &m_tra; }
+
+    connection& conn() const { return *m_lease; }
+
+    /// <summary>
+    /// Number of the target the transaction runs on, zero is the primary
+    /// </summary>
+    size_t target() const { return m_target; }
+
+private:
+    friend class routing_pool;
+    pooled_transaction(pooled_connection&& lease, transaction&& tra, size_t target)
+        : m_lease{ std::move(lease) }, m_tra{ std::move(tra) }, m_target{ target }
+    {}
+
+private:
+    pooled_connection m_lease;  // declared first to outlive the transaction
+    transaction m_tra;
+    size_t m_target;
+};
+
+/// <summary>
+/// Connection pools of a primary database and its read-only replicas. Read-only transactions
+/// go to replicas in turn, skipping failed ones and ones lagging too much; read-write
+/// transactions, and read-only ones when no replica is usable, go to the primary.
+/// </summary>
+class routing_pool final
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// <summary>
+    /// Attach <paramref name="size"/> connections to every database
+    /// </summary>
+    /// <param name="primary">- primary database connection parameters</param>
+    /// <param name="replicas">- replica databases connection parameters</param>
+    /// <param name="size">- number of connections per database</param>
+    /// <param name="replica">- lag checks and failure handling, optional</param>
+    /// <param name="policy">- limits of priority classes, applied to each database separately, optional</param>
+    routing_pool(connection_params const& primary, std::vector<connection_params> const& replicas, unsigned size,
+        replica_policy const& replica = {}, admission_policy const& policy = {})
+        : m_replica{ replica }
+    {
+        if (m_replica.lag_query)
+        {
+            m_lag_query = m_replica.lag_query;
+            m_replica.lag_query = m_lag_query.c_str();
+        }
+
+        m_targets.push_back(std::make_unique<target>(primary, size, policy));
+        for (auto const& params : replicas)
+            m_targets.push_back(std::make_unique<target>(params, size, policy));
+    }
+
+    routing_pool(routing_pool const&) = delete;
+    routing_pool& operator=(routing_pool const&) = delete;
+
+    /// <summary>
+    /// Start new transaction on the primary or on a replica, depending on its access mode
+    /// </summary>
+    /// <param name="il">- isolation level</param>
+    /// <param name="lr">- lock resolution, optional</param>
+    /// <param name="da">- data access, read-only transactions are routed to replicas, optional</param>
+    /// <param name="p">- priority class of the request, optional</param>
+    /// <param name="d">- deadline, limits the wait for a connection and the transaction's work, optional</param>
+    /// <returns>transaction object with its connection</returns>
+    pooled_transaction start(isolation_level il = isolation_level::concurrency(), lock_resolution lr = {},
+        data_access da = {}, priority p = priority::normal, deadline d = {})
+    {
+        d = _detail::effective(d);
+        if (!da.mode)
+        {
+            for (size_t n = 1; n < m_targets.size(); ++n)
+            {
+                auto index = next_replica();
+                auto lease = try_replica(index, p);
+                if (!lease)
+                    continue;
+
+                try
+                {
+                    auto tra = start_on(*lease, index, il, lr, da, d);
+                    return pooled_transaction{ std::move(*lease), std::move(tra), index };
+                }
+                catch (sql_error const&)
+                {
+                    failed(index);
+                }
+            }
+        }
+
+        auto lease = m_targets[0]->pool.checkout(p, d);
+        auto tra = start_on(lease, 0, il, lr, da, d);
+        return pooled_transaction{ std::move(lease), std::move(tra), 0 };
+    }
+
+    /// <summary>
+    /// Health of the targets, the primary first, then replicas in construction order
+    /// </summary>
+    std::vector<target_health> health() const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        std::vector<target_health> res;
+        for (auto const& t : m_targets)
+            res.push_back(t->health);
+        return res;
+    }
+
+    admission_stats stats(size_t target, priority p) const
+    {
+        return m_targets.at(target)->pool.stats(p);
+    }
+
+    size_t replicas() const
+    {
+        return m_targets.size() - 1;
+    }
+
+private:
+    struct target
+    {
+        target(connection_params const& params, unsigned size, admission_policy const& policy)
+            : pool{ params, size, policy }
+        {}
+
+        connection_pool pool;
+        target_health health;
+        clock::time_point retry_at;
+        clock::time_point checked_at;
+        bool checking{};
+    };
+
+    size_t next_replica()
+    {
+        auto n = m_next.fetch_add(1, std::memory_order_relaxed);
+        return 1 + n % (m_targets.size() - 1);
+    }
+
+    // a connection to the replica when it is usable, nullptr otherwise
+    std::unique_ptr<pooled_connection> try_replica(size_t index, priority p)
+    {
+        auto& t = *m_targets[index];
+        auto now = clock::now();
+        bool recover = false;
+        bool check = false;
+        bool owns_check = false; // only the probing thread clears the flag
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (!t.health.healthy)
+            {
+                if (now < t.retry_at || t.checking)
+                    return nullptr;
+                recover = true;
+            }
+            else if (m_replica.max_lag.count() > 0 && t.health.lag > m_replica.max_lag.count())
+            {
+                if (now - t.checked_at < m_replica.check_interval || t.checking)
+                    return nullptr;
+            }
+
+            check = m_replica.lag_query && (recover || now - t.checked_at >= m_replica.check_interval) && !t.checking;
+            owns_check = recover || check;
+            if (owns_check)
+            {
+                t.checking = true; // one thread probes the replica, others use the cached state
+                t.checked_at = now;
+            }
+        }
+
+        try
+        {
+            // a busy replica is skipped rather than waited for, the primary may be idle
+            auto idle = t.pool.try_checkout(p);
+            if (!idle)
+            {
+                end_check(t, owns_check);
+                return nullptr;
+            }
+            auto lease = std::make_unique<pooled_connection>(std::move(*idle));
+            if (recover)
+                lease->reattach();
+
+            double lag = check ? query_lag(**lease) : 0;
+
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (owns_check)
+            {
+                if (check)
+                    t.health.lag = lag;
+                t.health.healthy = true;
+                t.checking = false;
+            }
+            if (m_replica.max_lag.count() > 0 && t.health.lag > m_replica.max_lag.count())
+                return nullptr;
+            return lease;
+        }
+        catch (sql_error const&)
+        {
+            end_check(t, owns_check);
+            failed(index);
+        }
+        catch (rejected_error const&)
+        {
+            end_check(t, owns_check);
+        }
+        catch (...)
+        {
+            end_check(t, owns_check);
+            throw;
+        }
+        return nullptr;
+    }
+
+    void end_check(target& t, bool owns_check)
+    {
+        if (!owns_check)
+            return;
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        t.checking = false;
+    }
+
+    double query_lag(connection& conn)
+    {
+        auto tra = conn.start(isolation_level::read_committed(true), lock_resolution::wait(), data_access::read_only());
+        auto rs = tra.cursor(m_replica.lag_query);
+        // no row or NULL means the replica can't tell its lag, don't use it
+        double lag = std::numeric_limits<double>::infinity();
+        if (rs.next() && !rs.get(0).is_null())
+            lag = rs.get(0).as<double>();
+        rs.close();
+        tra.commit();
+        return lag;
+    }
+
+    // retries once on a new attachment, a replica connection may be stale after the replica restarts
+    transaction start_on(pooled_connection& lease, size_t index, isolation_level il, lock_resolution lr,
+        data_access da, deadline const& d)
+    {
+        transaction tra = [&]
+        {
+            if (index == 0)
+                return lease->start(il, lr, da, d);
+
+            try
+            {
+                return lease->start(il, lr, da, d);
+            }
+            catch (sql_error const&)
+            {
+                lease.reattach();
+                return lease->start(il, lr, da, d);
+            }
+        }();
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        ++m_targets[index]->health.routed;
+        return tra;
+    }
+
+    void failed(size_t index)
+    {
+        auto& t = *m_targets[index];
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        t.health.healthy = false;
+        ++t.health.failures;
+        t.retry_at = clock::now() + m_replica.retry_after;
+    }
+
+private:
+    replica_policy m_replica;
+    std::string m_lag_query;
+    std::vector<std::unique_ptr<target>> m_targets;
+    std::atomic<size_t> m_next{};
+    mutable std::mutex m_mutex;
+};
+
+} // namespace fbsqlxx
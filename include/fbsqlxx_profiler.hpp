@@ -0,0 +1,337 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Page counters of an attachment, or their difference
+/// </summary>
+struct io_counters
+{
+    int64_t reads{};
+    int64_t writes{};
+    int64_t fetches{};
+    int64_t marks{};
+};
+
+/// <summary>
+/// Record reads of one table, RDB$RELATIONS.RDB$RELATION_ID identifies the table
+/// </summary>
+struct table_io
+{
+    unsigned relation_id{};
+    int64_t sequential_reads{};
+    int64_t indexed_reads{};
+};
+
+/// <summary>
+/// Aggregated I/O of one SQL text
+/// </summary>
+struct query_io
+{
+    std::string sql;
+    uint64_t samples{};
+    io_counters total;
+    io_counters max;
+    std::chrono::nanoseconds elapsed{};
+    std::vector<table_io> tables;   // ordered by relation_id
+};
+
+enum class io_metric
+{
+    reads, writes, fetches, marks, elapsed
+};
+
+
+namespace _detail {
+
+struct io_snapshot
+{
+    io_counters pages;
+    std::vector<table_io> tables;   // ordered by relation_id
+};
+
+// per-table items hold (2-byte relation id, 4-byte count) pairs
+static inline void add_table_counts(std::vector<table_io>& tables, info_item const& i, int64_t table_io::*counter)
+{
+    for (short pos = 0; pos + 6 <= i.length; pos += 6)
+    {
+        auto id = static_cast<unsigned>(portable_integer(i.data + pos, 2));
+        auto it = std::lower_bound(tables.begin(), tables.end(), id,
+            [](table_io const& t, unsigned id) { return t.relation_id < id; });
+        if (it == tables.end() || it->relation_id != id)
+            it = tables.insert(it, table_io{ id, 0, 0 });
+        (*it).*counter += portable_integer(i.data + pos + 2, 4);
+    }
+}
+
+static inline io_snapshot io_snapshot_of(connection const& conn)
+{
+    static const uint8_t items[] = {
+        isc_info_reads, isc_info_writes, isc_info_fetches, isc_info_marks,
+        isc_info_read_seq_count, isc_info_read_idx_count
+    };
+    // per-table counts grow with the number of tables touched, the buffer is reused by the thread
+    static thread_local std::vector<uint8_t> buffer(64 * 1024);
+
+    io_snapshot res;
+    for (auto i : conn.info(items, sizeof(items), buffer.data(), static_cast<unsigned>(buffer.size())))
+    {
+        switch (i.item)
+        {
+        case isc_info_reads: res.pages.reads = i.as_integer(); break;
+        case isc_info_writes: res.pages.writes = i.as_integer(); break;
+        case isc_info_fetches: res.pages.fetches = i.as_integer(); break;
+        case isc_info_marks: res.pages.marks = i.as_integer(); break;
+        case isc_info_read_seq_count: add_table_counts(res.tables, i, &table_io::sequential_reads); break;
+        case isc_info_read_idx_count: add_table_counts(res.tables, i, &table_io::indexed_reads); break;
+        }
+    }
+    return res;
+}
+
+// after - before, both ordered by relation_id, tables without reads are dropped
+static inline std::vector<table_io> table_delta(std::vector<table_io> const& before, std::vector<table_io> const& after)
+{
+    std::vector<table_io> res;
+    auto b = before.begin();
+    for (auto const& a : after)
+    {
+        while (b != before.end() && b->relation_id < a.relation_id)
+            ++b;
+        table_io d = a;
+        if (b != before.end() && b->relation_id == a.relation_id)
+        {
+            d.sequential_reads -= b->sequential_reads;
+            d.indexed_reads -= b->indexed_reads;
+        }
+        if (d.sequential_reads || d.indexed_reads)
+            res.push_back(d);
+    }
+    return res;
+}
+
+static inline int64_t metric_of(query_io const& q, io_metric m)
+{
+    switch (m)
+    {
+    case io_metric::reads: return q.total.reads;
+    case io_metric::writes: return q.total.writes;
+    case io_metric::fetches: return q.total.fetches;
+    case io_metric::marks: return q.total.marks;
+    case io_metric::elapsed: return q.elapsed.count();
+    }
+    return 0;
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Samples page and per-table read counters of an attachment around units of work and
+/// aggregates the differences by SQL text. Counters belong to the whole attachment, so work
+/// running concurrently on the same connection is accounted to the measured unit too.
+/// </summary>
+class io_profiler final
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// <summary>
+    /// Measures one unit of work from construction to destruction, if it is sampled
+    /// </summary>
+    class scope final
+    {
+    public:
+        scope(io_profiler& profiler, connection const& conn, const char* sql)
+            : m_profiler{ profiler }, m_conn{ conn }, m_sql{ sql }, m_active{ profiler.sampled() }
+        {
+            if (!m_active)
+                return;
+            try
+            {
+                m_before = _detail::io_snapshot_of(m_conn);
+                m_started = clock::now();
+            }
+            catch (error const&)
+            {
+                m_active = false; // profiling never breaks the work itself
+            }
+        }
+
+        ~scope()
+        {
+            if (!m_active)
+                return;
+            try
+            {
+                auto elapsed = clock::now() - m_started;
+                auto after = _detail::io_snapshot_of(m_conn);
+                m_profiler.record(m_sql, m_before, after, elapsed);
+            }
+            catch (...)
+            {
+            }
+        }
+
+        scope(scope const&) = delete;
+        scope& operator=(scope const&) = delete;
+
+        bool sampled() const
+        {
+            return m_active;
+        }
+
+    private:
+        io_profiler& m_profiler;
+        connection const& m_conn;
+        const char* m_sql;
+        bool m_active;
+        _detail::io_snapshot m_before;
+        clock::time_point m_started;
+    };
+
+    /// <summary>
+    /// Create a profiler
+    /// </summary>
+    /// <param name="sample_rate">- share of units measured, from 0 (none) to 1 (all)</param>
+    explicit io_profiler(double sample_rate = 1.0)
+    {
+        set_sample_rate(sample_rate);
+    }
+
+    io_profiler(io_profiler const&) = delete;
+    io_profiler& operator=(io_profiler const&) = delete;
+
+    void set_sample_rate(double sample_rate)
+    {
+        uint64_t every = 0;
+        if (sample_rate > 0)
+            every = sample_rate >= 1 ? 1 : static_cast<uint64_t>(std::llround(1 / sample_rate));
+        m_every.store(every, std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Run a function and account its I/O to the SQL text, if it is sampled
+    /// </summary>
+    template <typename Func>
+    decltype(auto) profile(connection const& conn, const char* sql, Func&& func)
+    {
+        scope s{ *this, conn, sql };
+        return func();
+    }
+
+    /// <summary>
+    /// Most expensive SQL texts by a metric
+    /// </summary>
+    std::vector<query_io> top(size_t n, io_metric by = io_metric::reads) const
+    {
+        std::vector<query_io> res;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            res.reserve(m_queries.size());
+            for (auto const& q : m_queries)
+                res.push_back(q.second);
+        }
+        auto count = std::min(n, res.size());
+        std::partial_sort(res.begin(), res.begin() + count, res.end(), [by](query_io const& a, query_io const& b)
+            {
+                return _detail::metric_of(a, by) > _detail::metric_of(b, by);
+            });
+        res.resize(count);
+        return res;
+    }
+
+    /// <summary>
+    /// Tables with the most record reads, sequential and indexed together, over all sampled work
+    /// </summary>
+    std::vector<table_io> top_tables(size_t n) const
+    {
+        std::vector<table_io> res;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (auto const& q : m_queries)
+                merge(res, q.second.tables);
+        }
+        auto count = std::min(n, res.size());
+        std::partial_sort(res.begin(), res.begin() + count, res.end(), [](table_io const& a, table_io const& b)
+            {
+                return a.sequential_reads + a.indexed_reads > b.sequential_reads + b.indexed_reads;
+            });
+        res.resize(count);
+        return res;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_queries.clear();
+    }
+
+private:
+    bool sampled()
+    {
+        auto every = m_every.load(std::memory_order_relaxed);
+        return every != 0 && m_counter.fetch_add(1, std::memory_order_relaxed) % every == 0;
+    }
+
+    // adds counters of tables to an ordered list
+    static void merge(std::vector<table_io>& to, std::vector<table_io> const& from)
+    {
+        for (auto const& t : from)
+        {
+            auto it = std::lower_bound(to.begin(), to.end(), t.relation_id,
+                [](table_io const& x, unsigned id) { return x.relation_id < id; });
+            if (it == to.end() || it->relation_id != t.relation_id)
+                it = to.insert(it, table_io{ t.relation_id, 0, 0 });
+            it->sequential_reads += t.sequential_reads;
+            it->indexed_reads += t.indexed_reads;
+        }
+    }
+
+    void record(const char* sql, _detail::io_snapshot const& before, _detail::io_snapshot const& after, clock::duration elapsed)
+    {
+        io_counters d{
+            after.pages.reads - before.pages.reads,
+            after.pages.writes - before.pages.writes,
+            after.pages.fetches - before.pages.fetches,
+            after.pages.marks - before.pages.marks
+        };
+        auto tables = _detail::table_delta(before.tables, after.tables);
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        auto& q = m_queries[sql];
+        if (q.samples == 0)
+            q.sql = sql;
+        ++q.samples;
+        q.total.reads += d.reads;
+        q.total.writes += d.writes;
+        q.total.fetches += d.fetches;
+        q.total.marks += d.marks;
+        q.max.reads = std::max(q.max.reads, d.reads);
+        q.max.writes = std::max(q.max.writes, d.writes);
+        q.max.fetches = std::max(q.max.fetches, d.fetches);
+        q.max.marks = std::max(q.max.marks, d.marks);
+        q.elapsed += elapsed;
+        merge(q.tables, tables);
+    }
+
+private:
+    std::atomic<uint64_t> m_every{ 1 };
+    std::atomic<uint64_t> m_counter{};
+    std::unordered_map<std::string, query_io> m_queries;
+    mutable std::mutex m_mutex;
+};
+
+} // namespace fbsqlxx
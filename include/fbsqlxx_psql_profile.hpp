@@ -0,0 +1,290 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Statement or PSQL routine seen by the server profiler, PLG$PROF_STATEMENTS
+/// </summary>
+struct profile_statement
+{
+    int64_t id{};
+    int64_t parent_id{};            // zero for top-level statements
+    std::string type;               // BLOCK, FUNCTION, PROCEDURE, TRIGGER
+    std::string package;
+    std::string routine;
+    std::string sql;
+};
+
+/// <summary>
+/// One execution of a statement, PLG$PROF_REQUESTS
+/// </summary>
+struct profile_request
+{
+    int64_t statement_id{};
+    int64_t request_id{};
+    int64_t caller_statement_id{};  // zero when called by the client
+    int64_t caller_request_id{};
+    std::chrono::nanoseconds elapsed{};
+};
+
+/// <summary>
+/// Timings of a PSQL line, summed over executions, PLG$PROF_PSQL_STATS
+/// </summary>
+struct profile_line
+{
+    int64_t statement_id{};
+    int line{};
+    int column{};
+    int64_t counter{};
+    std::chrono::nanoseconds min_elapsed{};
+    std::chrono::nanoseconds max_elapsed{};
+    std::chrono::nanoseconds total_elapsed{};
+};
+
+/// <summary>
+/// Plan node with its open and fetch timings, PLG$PROF_RECORD_SOURCES and PLG$PROF_RECORD_SOURCE_STATS
+/// </summary>
+struct profile_record_source
+{
+    int64_t statement_id{};
+    int64_t cursor_id{};
+    int64_t record_source_id{};
+    int64_t parent_record_source_id{};
+    int level{};
+    std::string access_path;
+    int64_t open_counter{};
+    std::chrono::nanoseconds open_elapsed{};
+    int64_t fetch_counter{};
+    std::chrono::nanoseconds fetch_elapsed{};
+};
+
+/// <summary>
+/// Client-side time of an SQL text, e.g. io_profiler's query_io::elapsed
+/// </summary>
+struct client_timing
+{
+    std::string sql;
+    std::chrono::nanoseconds elapsed{};
+};
+
+
+namespace _detail {
+
+// sums over BIGINT are INT128 in Firebird 4 and later, queries cast them back to BIGINT
+static inline int64_t profile_number(result_set const& rs, unsigned index)
+{
+    auto f = rs.get(index);
+    return f.is_null() ? 0 : f.as<int64_t>();
+}
+
+static inline std::string profile_text(result_set const& rs, unsigned index)
+{
+    auto f = rs.get(index);
+    return f.is_null() ? std::string{} : f.as<std::string>();
+}
+
+// flame graph frames are separated by semicolons and the value follows a space
+static inline std::string frame_name(std::string text)
+{
+    auto eol = text.find_first_of("\r\n");
+    if (eol != std::string::npos)
+        text.resize(eol);
+    if (text.size() > 80)
+        text.resize(80);
+    for (auto& c : text)
+        if (c == ';')
+            c = ',';
+    return text;
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Data of a finished server profiler session
+/// </summary>
+class psql_profile final
+{
+public:
+    /// <summary>
+    /// Read profiler tables of a session, the session must be finished
+    /// </summary>
+    /// <param name="conn">- connection to the profiled database</param>
+    /// <param name="profile_id">- value returned by connection::start_profiling()</param>
+    psql_profile(connection& conn, int64_t profile_id)
+        : m_id{ profile_id }
+    {
+        using std::chrono::nanoseconds;
+        using namespace _detail;
+
+        auto tr = conn.start(isolation_level::concurrency(), lock_resolution::wait(), data_access::read_only());
+        {
+            auto rs = tr.cursor("select statement_id, parent_statement_id, statement_type, package_name, routine_name, "
+                "cast(left(sql_text, 8000) as varchar(8000)) "
+                "from plg$prof_statements where profile_id = ?", profile_id);
+            while (rs.next())
+            {
+                m_statements.push_back({ profile_number(rs, 0), profile_number(rs, 1), profile_text(rs, 2),
+                    profile_text(rs, 3), profile_text(rs, 4), profile_text(rs, 5) });
+            }
+            rs.close();
+        }
+        {
+            auto rs = tr.cursor("select statement_id, request_id, caller_statement_id, caller_request_id, total_elapsed_time "
+                "from plg$prof_requests where profile_id = ?", profile_id);
+            while (rs.next())
+            {
+                m_requests.push_back({ profile_number(rs, 0), profile_number(rs, 1), profile_number(rs, 2),
+                    profile_number(rs, 3), nanoseconds{ profile_number(rs, 4) } });
+            }
+            rs.close();
+        }
+        {
+            auto rs = tr.cursor("select statement_id, line_num, column_num, cast(sum(counter) as bigint), min(min_elapsed_time), "
+                "max(max_elapsed_time), cast(sum(total_elapsed_time) as bigint) "
+                "from plg$prof_psql_stats where profile_id = ? "
+                "group by statement_id, line_num, column_num", profile_id);
+            while (rs.next())
+            {
+                m_lines.push_back({ profile_number(rs, 0), static_cast<int>(profile_number(rs, 1)),
+                    static_cast<int>(profile_number(rs, 2)), profile_number(rs, 3), nanoseconds{ profile_number(rs, 4) },
+                    nanoseconds{ profile_number(rs, 5) }, nanoseconds{ profile_number(rs, 6) } });
+            }
+            rs.close();
+        }
+        {
+            auto rs = tr.cursor("select s.statement_id, s.cursor_id, s.record_source_id, s.parent_record_source_id, s.level, "
+                "cast(left(s.access_path, 8000) as varchar(8000)), t.open_counter, t.open_elapsed, t.fetch_counter, t.fetch_elapsed "
+                "from plg$prof_record_sources s left join ("
+                "  select statement_id, cursor_id, record_source_id, cast(sum(open_counter) as bigint) open_counter, "
+                "    cast(sum(open_total_elapsed_time) as bigint) open_elapsed, cast(sum(fetch_counter) as bigint) fetch_counter, "
+                "    cast(sum(fetch_total_elapsed_time) as bigint) fetch_elapsed "
+                "  from plg$prof_record_source_stats where profile_id = ? "
+                "  group by statement_id, cursor_id, record_source_id) t "
+                "on t.statement_id = s.statement_id and t.cursor_id = s.cursor_id and t.record_source_id = s.record_source_id "
+                "where s.profile_id = ? "
+                "order by s.statement_id, s.cursor_id, s.record_source_id", profile_id, profile_id);
+            while (rs.next())
+            {
+                m_record_sources.push_back({ profile_number(rs, 0), profile_number(rs, 1), profile_number(rs, 2),
+                    profile_number(rs, 3), static_cast<int>(profile_number(rs, 4)), profile_text(rs, 5),
+                    profile_number(rs, 6), nanoseconds{ profile_number(rs, 7) }, profile_number(rs, 8),
+                    nanoseconds{ profile_number(rs, 9) } });
+            }
+            rs.close();
+        }
+        tr.commit();
+    }
+
+    int64_t id() const { return m_id; }
+
+    std::vector<profile_statement> const& statements() const { return m_statements; }
+    std::vector<profile_request> const& requests() const { return m_requests; }
+    std::vector<profile_line> const& lines() const { return m_lines; }
+    std::vector<profile_record_source> const& record_sources() const { return m_record_sources; }
+
+    /// <summary>
+    /// Add time measured by the client for an SQL text, the part not spent on the server
+    /// shows up in the flame graph as a [client] frame under the statement
+    /// </summary>
+    void add_client_timing(std::string sql, std::chrono::nanoseconds elapsed)
+    {
+        m_client.push_back({ std::move(sql), elapsed });
+    }
+
+    /// <summary>
+    /// Write self times of call stacks in the collapsed format of flame graph tools,
+    /// one "frame;frame;frame nanoseconds" line per stack
+    /// </summary>
+    void write_flame_graph(std::ostream& os) const
+    {
+        using key = std::pair<int64_t, int64_t>;    // statement id, request id
+
+        std::map<int64_t, profile_statement const*> statements;
+        for (auto const& s : m_statements)
+            statements[s.id] = &s;
+
+        std::map<key, profile_request const*> requests;
+        std::map<key, std::chrono::nanoseconds> children;
+        for (auto const& r : m_requests)
+        {
+            requests[{ r.statement_id, r.request_id }] = &r;
+            if (r.caller_request_id)
+                children[{ r.caller_statement_id, r.caller_request_id }] += r.elapsed;
+        }
+
+        auto name = [&](int64_t statement_id)
+        {
+            auto it = statements.find(statement_id);
+            if (it == statements.end())
+                return "statement " + std::to_string(statement_id);
+            auto const& s = *it->second;
+            if (!s.routine.empty())
+                return _detail::frame_name(s.package.empty() ? s.routine : s.package + "." + s.routine);
+            if (!s.sql.empty())
+                return _detail::frame_name(s.sql);
+            return _detail::frame_name(s.type + " " + std::to_string(s.id));
+        };
+
+        std::map<std::string, std::chrono::nanoseconds> stacks;
+        std::map<std::string, std::chrono::nanoseconds> server_time;  // of top-level statements by SQL text
+        for (auto const& r : m_requests)
+        {
+            auto stack = name(r.statement_id);
+            key caller{ r.caller_statement_id, r.caller_request_id };
+            for (size_t depth = 0; caller.second && depth < 1000; ++depth)
+            {
+                auto it = requests.find(caller);
+                if (it == requests.end())
+                    break;
+                stack = name(caller.first) + ";" + stack;
+                caller = { it->second->caller_statement_id, it->second->caller_request_id };
+            }
+
+            auto self = r.elapsed;
+            auto c = children.find({ r.statement_id, r.request_id });
+            if (c != children.end())
+                self -= c->second;
+            if (self.count() > 0)
+                stacks[stack] += self;
+
+            if (!r.caller_request_id)
+            {
+                auto s = statements.find(r.statement_id);
+                if (s != statements.end())
+                    server_time[s->second->sql] += r.elapsed;
+            }
+        }
+
+        for (auto const& t : m_client)
+        {
+            auto it = server_time.find(t.sql);
+            auto overhead = it == server_time.end() ? t.elapsed : t.elapsed - it->second;
+            if (overhead.count() > 0)
+                stacks[_detail::frame_name(t.sql) + ";[client]"] += overhead;
+        }
+
+        for (auto const& s : stacks)
+            os << s.first << ' ' << s.second.count() << '\n';
+    }
+
+private:
+    int64_t m_id;
+    std::vector<profile_statement> m_statements;
+    std::vector<profile_request> m_requests;
+    std::vector<profile_line> m_lines;
+    std::vector<profile_record_source> m_record_sources;
+    std::vector<client_timing> m_client;
+};
+
+} // namespace fbsqlxx
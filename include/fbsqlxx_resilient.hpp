@@ -0,0 +1,282 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Check if an error means the connection is gone: network failure, server or database shutdown
+/// </summary>
+static inline bool is_connection_lost(sql_error const& e)
+{
+    for (auto code : { isc_network_error, isc_net_read_err, isc_net_write_err, isc_lost_db_connection,
+        isc_shutdown, isc_att_shutdown, isc_bad_db_handle })
+    {
+        if (e.has(code))
+            return true;
+    }
+    return false;
+}
+
+/// <summary>
+/// Reattach attempts and delays between them, the delay grows by <em>multiplier</em> up to <em>max_backoff</em>
+/// </summary>
+struct reconnect_policy
+{
+    unsigned max_attempts{ 5 };
+    std::chrono::milliseconds initial_backoff{ 100 };
+    std::chrono::milliseconds max_backoff{ 5000 };
+    double multiplier{ 2.0 };
+};
+
+struct reconnect_stats
+{
+    uint64_t lost{};            // lost connection errors seen
+    uint64_t reconnects{};      // successful reattaches
+    uint64_t failed_attempts{}; // reattach attempts which failed
+    uint64_t replays{};         // idempotent work run again after a reattach
+};
+
+/// <summary>
+/// Connection which reattaches with the original parameters when it is lost, prepares cached
+/// statements again and replays work marked idempotent. Other work fails with the original
+/// error once, the connection is usable again for the next call.
+/// Like connection, it must not be used by several threads at once.
+/// </summary>
+class resilient_connection final
+{
+public:
+    using statement_id = size_t;
+
+    /// <summary>
+    /// Attach to a database
+    /// </summary>
+    /// <param name="params">- connection parameters, copied for later reattaches</param>
+    /// <param name="policy">- reattach attempts and backoff, optional</param>
+    resilient_connection(connection_params const& params, reconnect_policy const& policy = {})
+        : m_params{ params }, m_policy{ policy }
+        , m_conn{ std::make_unique<connection>(m_params.get()) }
+    {}
+
+    resilient_connection(resilient_connection const&) = delete;
+    resilient_connection& operator=(resilient_connection const&) = delete;
+
+    /// <summary>
+    /// Current attachment, it changes after a reattach
+    /// </summary>
+    connection& get()
+    {
+        if (!m_conn)
+            reconnect();
+        return *m_conn;
+    }
+
+    reconnect_stats const& stats() const
+    {
+        return m_stats;
+    }
+
+    /// <summary>
+    /// Prepare a statement and keep it, it is prepared again after every reattach
+    /// </summary>
+    /// <param name="sql">- SQL statement string</param>
+    /// <param name="idempotent">- running the statement twice has the same effect as once, so it may be replayed</param>
+    /// <returns>statement identifier for execute() and query()</returns>
+    statement_id prepare(std::string sql, bool idempotent = false)
+    {
+        if (!m_conn)
+            reconnect();
+
+        m_cache.push_back({ std::move(sql), idempotent, std::nullopt });
+        auto id = m_cache.size() - 1;
+        try
+        {
+            auto tr = m_conn->start(isolation_level::read_committed(true), lock_resolution::wait(), data_access::read_only());
+            m_cache[id].stmt.emplace(tr.prepare(m_cache[id].sql.c_str()));
+            tr.commit();
+        }
+        catch (...)
+        {
+            m_cache.pop_back();
+            throw;
+        }
+        return id;
+    }
+
+    /// <summary>
+    /// Cached statement bound to a transaction, for use inside transact()
+    /// </summary>
+    statement& cached(statement_id id, transaction const& tra)
+    {
+        auto& c = m_cache.at(id);
+        if (!c.stmt)
+            throw logic_error("fbsqlxx::resilient_connection - statement is not prepared");
+        return c.stmt->rebind(tra);
+    }
+
+    /// <summary>
+    /// Run a function in a new transaction and commit it, reattach if the connection is lost
+    /// </summary>
+    /// <param name="func">- callable, takes <em>transaction&amp;</em></param>
+    /// <param name="idempotent">- the function may be run again after a reattach, up to <em>max_attempts</em> times</param>
+    /// <param name="il">- isolation level, optional</param>
+    /// <param name="lr">- lock resolution, optional</param>
+    /// <param name="da">- data access, optional</param>
+    /// <returns>the function result</returns>
+    template <typename Func>
+    auto transact(Func&& func, bool idempotent = false,
+        isolation_level il = isolation_level::read_committed(true), lock_resolution lr = lock_resolution::wait(),
+        data_access da = {}) -> std::invoke_result_t<Func&, transaction&>
+    {
+        return run(func, [idempotent] { return idempotent; }, il, lr, da);
+    }
+
+    /// <summary>
+    /// Execute a cached statement in its own transaction
+    /// </summary>
+    /// <param name="id">- statement identifier</param>
+    /// <param name="args">- statement parameters</param>
+    /// <returns>affected rows count</returns>
+    template <typename ...Args>
+    size_t execute(statement_id id, Args const& ...args)
+    {
+        return transact([&](transaction& tr)
+            {
+                return cached(id, tr).execute(args...);
+            }, m_cache.at(id).idempotent);
+    }
+
+    /// <summary>
+    /// Open a cached query in its own transaction and pass every row to a callback.
+    /// An idempotent query is replayed only if the connection is lost before the first row.
+    /// </summary>
+    /// <param name="id">- statement identifier</param>
+    /// <param name="on_row">- callable, takes <em>result_set&amp;</em> positioned on the current row</param>
+    /// <param name="args">- query parameters</param>
+    /// <returns>fetched rows count</returns>
+    template <typename OnRow, typename ...Args>
+    size_t query(statement_id id, OnRow&& on_row, Args const& ...args)
+    {
+        size_t rows = 0;
+        bool idempotent = m_cache.at(id).idempotent;
+        return run([&](transaction& tr)
+            {
+                auto rs = cached(id, tr).cursor(args...);
+                while (rs.next())
+                {
+                    ++rows;
+                    on_row(rs);
+                }
+                rs.close();
+                return rows;
+            },
+            [&] { return idempotent && rows == 0; },
+            isolation_level::read_committed(true), lock_resolution::wait(), data_access{});
+    }
+
+    /// <summary>
+    /// Drop the current attachment and attach again, with backoff between failed attempts
+    /// </summary>
+    void reconnect()
+    {
+        for (auto& c : m_cache)
+            c.stmt.reset();
+        m_conn.reset();
+
+        auto delay = m_policy.initial_backoff;
+        for (unsigned attempt = 1;; ++attempt)
+        {
+            try
+            {
+                auto conn = std::make_unique<connection>(m_params.get());
+                auto tr = conn->start(isolation_level::read_committed(true), lock_resolution::wait(), data_access::read_only());
+                for (auto& c : m_cache)
+                    c.stmt.emplace(tr.prepare(c.sql.c_str()));
+                tr.commit();
+
+                m_conn = std::move(conn);
+                ++m_stats.reconnects;
+                return;
+            }
+            catch (sql_error const&)
+            {
+                for (auto& c : m_cache)
+                    c.stmt.reset();
+
+                ++m_stats.failed_attempts;
+                auto d = deadline_scope::current();
+                if (attempt >= m_policy.max_attempts || (d.is_set() && d.remaining() < delay))
+                    throw;
+            }
+
+            std::this_thread::sleep_for(delay);
+            auto next = std::chrono::duration_cast<std::chrono::milliseconds>(delay * m_policy.multiplier);
+            delay = next < m_policy.max_backoff ? next : m_policy.max_backoff;
+        }
+    }
+
+private:
+    template <typename Func, typename Replayable>
+    auto run(Func&& func, Replayable replayable, isolation_level il, lock_resolution lr, data_access da)
+        -> std::invoke_result_t<Func&, transaction&>
+    {
+        for (unsigned replay = 0;; ++replay)
+        {
+            if (!m_conn)
+                reconnect();
+
+            try
+            {
+                auto tr = m_conn->start(il, lr, da);
+                if constexpr (std::is_void_v<std::invoke_result_t<Func&, transaction&>>)
+                {
+                    func(tr);
+                    tr.commit();
+                    return;
+                }
+                else
+                {
+                    auto result = func(tr);
+                    tr.commit();
+                    return result;
+                }
+            }
+            catch (sql_error const& e)
+            {
+                if (!is_connection_lost(e))
+                    throw;
+
+                ++m_stats.lost;
+                bool again = replayable() && replay < m_policy.max_attempts;
+                reconnect();
+                if (!again)
+                    throw;
+                ++m_stats.replays;
+            }
+        }
+    }
+
+    struct cached_statement
+    {
+        std::string sql;
+        bool idempotent;
+        std::optional<statement> stmt;
+    };
+
+    _detail::params_holder m_params;
+    reconnect_policy m_policy;
+    std::unique_ptr<connection> m_conn;
+    std::vector<cached_statement> m_cache;
+    reconnect_stats m_stats;
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,406 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_events.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Column of a table or view, from RDB$RELATION_FIELDS and RDB$FIELDS
+/// </summary>
+struct column_info
+{
+    std::string name;
+    std::string domain;         // RDB$FIELD_SOURCE, RDB$nnn for inline types
+    int position{};
+    int type{};                 // RDB$FIELD_TYPE
+    int sub_type{};
+    int length{};               // bytes
+    int char_length{};          // characters, text types only
+    int precision{};
+    int scale{};
+    bool nullable{};
+    bool computed{};
+    bool identity{};
+
+    /// <summary>
+    /// Type as written in DDL or CAST, e.g. <em>VARCHAR(30)</em> or <em>NUMERIC(18, 2)</em>
+    /// </summary>
+    std::string sql_type() const
+    {
+        auto exact = [this](const char* integer) -> std::string
+        {
+            if (sub_type == 0 && scale == 0)
+                return integer;
+            return std::string{ sub_type == 2 ? "DECIMAL(" : "NUMERIC(" } + std::to_string(precision) + ", "
+                + std::to_string(-scale) + ")";
+        };
+
+        switch (type)
+        {
+        case 7: return exact("SMALLINT");
+        case 8: return exact("INTEGER");
+        case 16: return exact("BIGINT");
+        case 26: return exact("INT128");
+        case 10: return "FLOAT";
+        case 27: return "DOUBLE PRECISION";
+        case 24: return "DECFLOAT(16)";
+        case 25: return "DECFLOAT(34)";
+        case 12: return "DATE";
+        case 13: return "TIME";
+        case 28: return "TIME WITH TIME ZONE";
+        case 35: return "TIMESTAMP";
+        case 29: return "TIMESTAMP WITH TIME ZONE";
+        case 23: return "BOOLEAN";
+        case 14: return "CHAR(" + std::to_string(char_length ? char_length : length) + ")";
+        case 37: return "VARCHAR(" + std::to_string(char_length ? char_length : length) + ")";
+        case 261: return "BLOB SUB_TYPE " + std::to_string(sub_type);
+        }
+        return "UNKNOWN";
+    }
+};
+
+/// <summary>
+/// Index of a table with its constraint, from RDB$INDICES and RDB$INDEX_SEGMENTS
+/// </summary>
+struct index_info
+{
+    std::string name;
+    std::vector<std::string> columns;   // empty for expression indices
+    std::string constraint;             // constraint name, empty for plain indices
+    std::string constraint_type;        // PRIMARY KEY, UNIQUE or FOREIGN KEY
+    bool unique{};
+    bool descending{};
+    bool active{};
+    bool expression{};
+
+    // foreign keys only
+    std::string ref_table;
+    std::vector<std::string> ref_columns;
+};
+
+/// <summary>
+/// Table or view with its columns and indices
+/// </summary>
+struct table_info
+{
+    std::string name;
+    bool view{};
+    int format{};                       // RDB$FORMAT, grows with every change of columns
+    std::vector<column_info> columns;   // in position order
+    std::vector<std::string> primary_key;
+    std::vector<index_info> indices;
+
+    /// <summary>
+    /// Find a column by name, nullptr when there's no such column
+    /// </summary>
+    column_info const* column(std::string const& column_name) const
+    {
+        auto it = m_columns.find(column_name);
+        return it == m_columns.end() ? nullptr : &columns[it->second];
+    }
+
+    /// <summary>
+    /// Foreign key indices
+    /// </summary>
+    std::vector<index_info const*> foreign_keys() const
+    {
+        std::vector<index_info const*> res;
+        for (auto const& i : indices)
+        {
+            if (i.constraint_type == "FOREIGN KEY")
+                res.push_back(&i);
+        }
+        return res;
+    }
+
+private:
+    friend class schema_cache;
+    std::unordered_map<std::string, size_t> m_columns;
+};
+
+
+/// <summary>
+/// In-memory model of user tables and views, loaded with a few bulk queries over the RDB$ tables.
+/// Not thread safe, pointers to tables are valid until the next refresh.
+/// </summary>
+class schema_cache final
+{
+public:
+    /// <summary>
+    /// Name of the event posted by the trigger from install_ddl_trigger()
+    /// </summary>
+    static constexpr const char* default_event = "FBSQLXX_SCHEMA_CHANGED";
+
+    /// <summary>
+    /// Load the whole schema
+    /// </summary>
+    /// <param name="conn">- connection, must outlive the cache</param>
+    explicit schema_cache(connection& conn)
+        : m_conn{ conn }
+    {
+        refresh();
+    }
+
+    /// <summary>
+    /// Find a table or view by name, nullptr when there's no such table
+    /// </summary>
+    /// <param name="name">- name as stored in RDB$RELATIONS, i.e. upper case unless quoted in DDL</param>
+    table_info const* table(std::string const& name) const
+    {
+        auto it = m_tables.find(name);
+        return it == m_tables.end() ? nullptr : &it->second;
+    }
+
+    /// <summary>
+    /// Names of all tables and views
+    /// </summary>
+    std::vector<std::string> tables() const
+    {
+        std::vector<std::string> res;
+        res.reserve(m_tables.size());
+        for (auto const& t : m_tables)
+            res.push_back(t.first);
+        return res;
+    }
+
+    /// <summary>
+    /// Reload tables whose columns or indices have changed since the last refresh, drop removed ones.
+    /// One cheap query finds changes, when nothing changed nothing else is read.
+    /// </summary>
+    /// <returns>number of added, changed and removed tables</returns>
+    size_t refresh()
+    {
+        auto tr = m_conn.start(isolation_level::concurrency(), lock_resolution::wait(), data_access::read_only());
+
+        std::unordered_map<std::string, fingerprint> current;
+        auto rs = tr.cursor(
+            "select trim(r.rdb$relation_name), coalesce(r.rdb$format, 0), iif(r.rdb$view_blr is null, 0, 1), "
+            "(select count(*) || ':' || coalesce(sum(mod(hash(i.rdb$index_name), 1000003) + i.rdb$index_id * 2 "
+            "+ coalesce(i.rdb$index_inactive, 0)), 0) from rdb$indices i where i.rdb$relation_name = r.rdb$relation_name) "
+            "from rdb$relations r where coalesce(r.rdb$system_flag, 0) = 0");
+        while (rs.next())
+        {
+            auto& f = current[rs.get(0).as<std::string>()];
+            f.format = rs.get(1).as<int>();
+            f.view = rs.get(2).as<int>() != 0;
+            f.indices = rs.get(3).as<std::string>();
+        }
+        rs.close();
+
+        std::vector<std::string> changed;
+        size_t removed = 0;
+        for (auto it = m_fingerprints.begin(); it != m_fingerprints.end();)
+        {
+            if (current.count(it->first))
+                ++it;
+            else
+            {
+                m_tables.erase(it->first);
+                it = m_fingerprints.erase(it);
+                ++removed;
+            }
+        }
+        for (auto const& c : current)
+        {
+            auto it = m_fingerprints.find(c.first);
+            if (it == m_fingerprints.end() || !(it->second == c.second))
+                changed.push_back(c.first);
+        }
+
+        if (!changed.empty())
+        {
+            // reading everything at once is cheaper than many filtered queries
+            if (changed.size() * 4 > current.size())
+            {
+                m_tables.clear();
+                load(tr, nullptr);
+            }
+            else
+            {
+                for (auto const& name : changed)
+                    load(tr, name.c_str());
+            }
+            for (auto& t : m_tables)
+            {
+                auto const& f = current[t.first];
+                t.second.name = t.first;
+                t.second.format = f.format;
+                t.second.view = f.view;
+            }
+        }
+        tr.commit();
+
+        m_fingerprints = std::move(current);
+        return changed.size() + removed;
+    }
+
+    /// <summary>
+    /// Refresh on a database event, usually posted by the trigger from install_ddl_trigger()
+    /// </summary>
+    /// <param name="event">- event name</param>
+    void watch(const char* event = default_event)
+    {
+        m_watch.reset(new event_watch{ m_conn, event });
+    }
+
+    /// <summary>
+    /// Refresh when the watched event has fired, otherwise do nothing, see watch()
+    /// </summary>
+    /// <returns>true when refreshed</returns>
+    bool poll()
+    {
+        if (!m_watch || !m_watch->fired())
+            return false;
+        refresh();
+        return true;
+    }
+
+    /// <summary>
+    /// Create or alter a database trigger posting an event after every DDL statement, Firebird 3 and later.
+    /// Requires the right to alter the database.
+    /// </summary>
+    /// <param name="conn">- connection</param>
+    /// <param name="event">- event name</param>
+    static void install_ddl_trigger(connection& conn, const char* event = default_event)
+    {
+        std::string sql = "create or alter trigger fbsqlxx_schema_changed after any ddl statement as begin post_event '";
+        for (auto p = event; *p; ++p)
+        {
+            if (*p == '\'')
+                sql += '\'';
+            sql += *p;
+        }
+        sql += "'; end";
+
+        auto tr = conn.start();
+        tr.execute(sql.c_str());
+        tr.commit();
+    }
+
+private:
+    struct fingerprint
+    {
+        int format{};
+        bool view{};
+        std::string indices;
+
+        bool operator==(fingerprint const& rhs) const
+        {
+            return format == rhs.format && view == rhs.view && indices == rhs.indices;
+        }
+    };
+
+    template <typename... Args>
+    static result_set select(transaction& tr, std::string sql, const char* filter, const char* order, Args&&... args)
+    {
+        if (filter)
+        {
+            sql += filter;
+            sql += order;
+            return tr.cursor(sql.c_str(), std::forward<Args>(args)...);
+        }
+        sql += order;
+        return tr.cursor(sql.c_str());
+    }
+
+    // load columns and indices of one table, or of all tables when the name is null
+    void load(transaction& tr, const char* name)
+    {
+        if (name)
+            m_tables[name] = table_info{};
+
+        auto rs = select(tr,
+            "select trim(rf.rdb$relation_name), trim(rf.rdb$field_name), trim(rf.rdb$field_source), "
+            "coalesce(rf.rdb$field_position, 0), f.rdb$field_type, coalesce(f.rdb$field_sub_type, 0), "
+            "coalesce(f.rdb$field_length, 0), coalesce(f.rdb$character_length, 0), coalesce(f.rdb$field_precision, 0), "
+            "coalesce(f.rdb$field_scale, 0), coalesce(rf.rdb$null_flag, f.rdb$null_flag, 0), "
+            "iif(f.rdb$computed_blr is null, 0, 1), iif(rf.rdb$identity_type is null, 0, 1) "
+            "from rdb$relation_fields rf join rdb$fields f on f.rdb$field_name = rf.rdb$field_source "
+            "join rdb$relations r on r.rdb$relation_name = rf.rdb$relation_name "
+            "where coalesce(r.rdb$system_flag, 0) = 0",
+            name ? " and rf.rdb$relation_name = ?" : nullptr,
+            " order by rf.rdb$relation_name, rf.rdb$field_position", name);
+        while (rs.next())
+        {
+            auto& t = m_tables[rs.get(0).as<std::string>()];
+            column_info c;
+            c.name = rs.get(1).as<std::string>();
+            c.domain = rs.get(2).as<std::string>();
+            c.position = rs.get(3).as<int>();
+            c.type = rs.get(4).as<int>();
+            c.sub_type = rs.get(5).as<int>();
+            c.length = rs.get(6).as<int>();
+            c.char_length = rs.get(7).as<int>();
+            c.precision = rs.get(8).as<int>();
+            c.scale = rs.get(9).as<int>();
+            c.nullable = rs.get(10).as<int>() == 0;
+            c.computed = rs.get(11).as<int>() != 0;
+            c.identity = rs.get(12).as<int>() != 0;
+            t.m_columns[c.name] = t.columns.size();
+            t.columns.push_back(std::move(c));
+        }
+        rs.close();
+
+        // segments of the table's indices and of the indices its foreign keys refer to
+        std::unordered_map<std::string, std::vector<std::string>> segments;
+        auto segment_rs = select(tr,
+            "select trim(s.rdb$index_name), trim(s.rdb$field_name) from rdb$index_segments s "
+            "join rdb$indices i on i.rdb$index_name = s.rdb$index_name where coalesce(i.rdb$system_flag, 0) = 0",
+            name ? " and (i.rdb$relation_name = ? or i.rdb$index_name in "
+                "(select rdb$foreign_key from rdb$indices where rdb$relation_name = ?))" : nullptr,
+            " order by s.rdb$index_name, s.rdb$field_position", name, name);
+        while (segment_rs.next())
+            segments[segment_rs.get(0).as<std::string>()].push_back(segment_rs.get(1).as<std::string>());
+        segment_rs.close();
+
+        auto index_rs = select(tr,
+            "select trim(i.rdb$relation_name), trim(i.rdb$index_name), coalesce(i.rdb$unique_flag, 0), "
+            "coalesce(i.rdb$index_type, 0), coalesce(i.rdb$index_inactive, 0), iif(i.rdb$expression_blr is null, 0, 1), "
+            "coalesce(trim(c.rdb$constraint_name), ''), coalesce(trim(c.rdb$constraint_type), ''), "
+            "coalesce(trim(i.rdb$foreign_key), ''), coalesce(trim(ri.rdb$relation_name), '') "
+            "from rdb$indices i "
+            "left join rdb$relation_constraints c on c.rdb$index_name = i.rdb$index_name "
+            "left join rdb$indices ri on ri.rdb$index_name = i.rdb$foreign_key "
+            "where coalesce(i.rdb$system_flag, 0) = 0",
+            name ? " and i.rdb$relation_name = ?" : nullptr,
+            " order by i.rdb$relation_name, i.rdb$index_name", name);
+        while (index_rs.next())
+        {
+            auto& t = m_tables[index_rs.get(0).as<std::string>()];
+            index_info i;
+            i.name = index_rs.get(1).as<std::string>();
+            i.unique = index_rs.get(2).as<int>() != 0;
+            i.descending = index_rs.get(3).as<int>() != 0;
+            i.active = index_rs.get(4).as<int>() == 0;
+            i.expression = index_rs.get(5).as<int>() != 0;
+            i.constraint = index_rs.get(6).as<std::string>();
+            i.constraint_type = index_rs.get(7).as<std::string>();
+            i.columns = segments[i.name];
+            auto ref_index = index_rs.get(8).as<std::string>();
+            if (!ref_index.empty())
+            {
+                i.ref_table = index_rs.get(9).as<std::string>();
+                i.ref_columns = segments[ref_index];
+            }
+            if (i.constraint_type == "PRIMARY KEY")
+                t.primary_key = i.columns;
+            t.indices.push_back(std::move(i));
+        }
+        index_rs.close();
+    }
+
+private:
+    connection& m_conn;
+    std::unordered_map<std::string, table_info> m_tables;
+    std::unordered_map<std::string, fingerprint> m_fingerprints;
+    std::unique_ptr<event_watch> m_watch;
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,287 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <string>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+struct service_params
+{
+    const char* server;         // host name or address, local or embedded service manager when null
+    const char* user;
+    const char* password;
+    const char* role;
+    int connect_timeout;
+    bool trusted_auth;
+};
+
+/// <summary>
+/// Parameters of a service action, e.g. backup, restore or trace start
+/// </summary>
+class service_action final
+{
+public:
+    /// <summary>
+    /// Start building an action
+    /// </summary>
+    /// <param name="action">- isc_action_svc_* constant</param>
+    explicit service_action(unsigned char action)
+        : m_spb{ _detail::util()->getXpbBuilder(&_detail::status(), Firebird::IXpbBuilder::SPB_START, nullptr, 0) }
+    {
+        m_spb->insertTag(&_detail::status(), action);
+    }
+
+    ~service_action()
+    {
+        m_spb->dispose();
+    }
+
+    service_action(service_action const&) = delete;
+    service_action& operator=(service_action const&) = delete;
+
+    service_action& add(unsigned char tag, const char* value)
+    {
+        m_spb->insertString(&_detail::status(), tag, value);
+        return *this;
+    }
+
+    service_action& add(unsigned char tag, std::string const& value)
+    {
+        return add(tag, value.c_str());
+    }
+
+    service_action& add(unsigned char tag, int value)
+    {
+        m_spb->insertInt(&_detail::status(), tag, value);
+        return *this;
+    }
+
+    service_action& add(unsigned char tag, int64_t value)
+    {
+        m_spb->insertBigInt(&_detail::status(), tag, value);
+        return *this;
+    }
+
+    /// <summary>
+    /// Add an argument without value, e.g. isc_spb_verbose
+    /// </summary>
+    service_action& add(unsigned char tag)
+    {
+        m_spb->insertTag(&_detail::status(), tag);
+        return *this;
+    }
+
+    unsigned length() const
+    {
+        return m_spb->getBufferLength(&_detail::status());
+    }
+
+    const unsigned char* buffer() const
+    {
+        return m_spb->getBuffer(&_detail::status());
+    }
+
+private:
+    Firebird::IXpbBuilder* m_spb;
+};
+
+enum class service_output
+{
+    data,       // some output is read
+    timeout,    // nothing arrived in time, the action is still running
+    end         // the action finished, no more output
+};
+
+/// <summary>
+/// Attachment to the services manager, runs one action at a time and reads its text output
+/// </summary>
+class service final
+{
+public:
+    /// <summary>
+    /// Attach to the services manager
+    /// </summary>
+    /// <param name="params">- services manager connection parameters</param>
+    service(service_params const& params)
+    {
+        using namespace Firebird;
+        using namespace _detail;
+
+        auto& status = _detail::status();
+        auto spb = make_autodestroy(util()->getXpbBuilder(&status, IXpbBuilder::SPB_ATTACH, nullptr, 0));
+        if (params.user)
+            spb->insertString(&status, isc_spb_user_name, params.user);
+        if (params.password)
+            spb->insertString(&status, isc_spb_password, params.password);
+        if (params.role)
+            spb->insertString(&status, isc_spb_sql_role_name, params.role);
+        if (params.trusted_auth)
+            spb->insertTag(&status, isc_spb_trusted_auth);
+        if (params.connect_timeout > 0)
+            spb->insertInt(&status, isc_spb_connect_timeout, params.connect_timeout);
+
+        std::string name = params.server ? std::string{ params.server } + ":service_mgr" : "service_mgr";
+        try
+        {
+            auto provider = make_autodestroy(master()->getDispatcher());
+            m_svc = provider->attachServiceManager(&status, name.c_str(), spb->getBufferLength(&status), spb->getBuffer(&status));
+        }
+        catch (const Firebird::FbException& ex)
+        {
+            _detail::throw_sql_error(ex);
+        }
+    }
+
+    ~service()
+    {
+        try
+        {
+            if (m_svc) m_svc->detach(&_detail::status());
+        }
+        catch (const Firebird::FbException&)
+        {
+        }
+    }
+
+    service(service const&) = delete;
+    service& operator=(service const&) = delete;
+
+    /// <summary>
+    /// Start an action, its output must be read before the next one
+    /// </summary>
+    void start(service_action const& action)
+    {
+        try
+        {
+            m_svc->start(&_detail::status(), action.length(), action.buffer());
+        }
+        catch (const Firebird::FbException& ex)
+        {
+            _detail::throw_sql_error(ex);
+        }
+    }
+
+    /// <summary>
+    /// Read the next chunk of the action output, as much as is ready
+    /// </summary>
+    /// <param name="text">- receives the text, possibly several lines</param>
+    /// <param name="timeout">- seconds to wait for output, zero waits until it arrives</param>
+    service_output read_text(std::string& text, unsigned timeout = 0)
+    {
+        unsigned char send[8];
+        unsigned send_length = 0;
+        if (timeout)
+        {
+            send[0] = isc_info_svc_timeout;
+            send[1] = 4;
+            send[2] = 0;
+            send[3] = static_cast<unsigned char>(timeout);
+            send[4] = static_cast<unsigned char>(timeout >> 8);
+            send[5] = static_cast<unsigned char>(timeout >> 16);
+            send[6] = static_cast<unsigned char>(timeout >> 24);
+            send_length = 7;
+        }
+
+        const unsigned char item = isc_info_svc_to_eof;
+        m_buffer.resize(32 * 1024);
+        query(send_length, send, 1, &item, static_cast<unsigned>(m_buffer.size()), m_buffer.data());
+
+        // the reply is the item, 2-byte length and text, followed by flags without length
+        text.clear();
+        bool not_ready = false;
+        bool more = false;
+        auto p = m_buffer.data();
+        auto end = p + m_buffer.size();
+        while (p < end && *p != isc_info_end)
+        {
+            auto tag = *p++;
+            if (tag == isc_info_data_not_ready)
+                not_ready = true;
+            else if (tag == isc_info_truncated)
+                more = true;
+            else if (tag == item && end - p >= 2)
+            {
+                auto length = static_cast<size_t>(portable_integer(p, 2));
+                p += 2;
+                if (length > static_cast<size_t>(end - p))
+                    throw logic_error("fbsqlxx::service - output buffer is broken");
+                text.assign(reinterpret_cast<const char*>(p), length);
+                p += length;
+            }
+            else
+                throw logic_error("fbsqlxx::service - unexpected output item");
+        }
+
+        if (!text.empty() || more)
+            return service_output::data;
+        if (not_ready)
+            return service_output::timeout;
+        return service_output::end;
+    }
+
+    /// <summary>
+    /// Pass every line of the action output to a callback until the action finishes
+    /// </summary>
+    /// <param name="on_line">- callable, takes <em>std::string const&amp;</em> without the line end</param>
+    template <typename OnLine>
+    void read_lines(OnLine&& on_line)
+    {
+        std::string text;
+        std::string line;
+        while (read_text(text) != service_output::end)
+        {
+            for (auto c : text)
+            {
+                if (c == '\n')
+                {
+                    on_line(line);
+                    line.clear();
+                }
+                else if (c != '\r')
+                    line += c;
+            }
+        }
+        if (!line.empty())
+            on_line(line);
+    }
+
+    /// <summary>
+    /// Wait for the action to finish, its output is discarded
+    /// </summary>
+    void wait()
+    {
+        std::string text;
+        while (read_text(text) != service_output::end)
+            ;
+    }
+
+    /// <summary>
+    /// Raw services manager query, for items not covered by the methods above
+    /// </summary>
+    void query(unsigned send_length, const unsigned char* send, unsigned items_length, const unsigned char* items,
+        unsigned buffer_length, unsigned char* buffer)
+    {
+        try
+        {
+            m_svc->query(&_detail::status(), send_length, send, items_length, items, buffer_length, buffer);
+        }
+        catch (const Firebird::FbException& ex)
+        {
+            _detail::throw_sql_error(ex);
+        }
+    }
+
+    Firebird::IService* handle() const
+    {
+        return m_svc;
+    }
+
+private:
+    Firebird::IService* m_svc{};
+    std::vector<unsigned char> m_buffer;
+};
+
+} // namespace fbsqlxx
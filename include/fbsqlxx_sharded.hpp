@@ -0,0 +1,346 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+
+namespace fbsqlxx {
+
+/// <summary>
+/// Runs one query on several identical databases (shards) in parallel and delivers the rows
+/// as a single stream: either merged by a key column, when every shard returns rows ordered
+/// by it, or concatenated in arrival order. Each shard buffers one block of row messages
+/// while the consumer reads the previous one, so memory does not depend on result size.
+/// </summary>
+class sharded_query final
+{
+public:
+    /// <summary>
+    /// Prepare a fan-out query
+    /// </summary>
+    /// <param name="shards">- shard connections, must outlive the object, may be shared with other threads</param>
+    /// <param name="sql">- SQL query string, the same for every shard</param>
+    sharded_query(std::vector<connection*> shards, std::string sql)
+        : m_shards{ std::move(shards) }, m_sql{ std::move(sql) }
+    {
+        if (m_shards.empty())
+            throw logic_error("sharded_query - no shards supplied");
+    }
+
+    /// <summary>
+    /// Merge the shard streams by a column, every shard query must be ordered by it the same way.
+    /// Text keys are merged by their bytes, so they must use a binary collation (the default one
+    /// of a character set, or OCTETS): with UNICODE_CI and the like the merged stream is out of order.
+    /// </summary>
+    /// <param name="column">- key column number, counted from zero</param>
+    /// <param name="descending">- shard streams are ordered descending</param>
+    sharded_query& order_by(unsigned column, bool descending = false)
+    {
+        m_merge = true;
+        m_key_column = column;
+        m_descending = descending;
+        return *this;
+    }
+
+    /// <summary>
+    /// Deliver at most <paramref name="rows"/> rows, every shard stops fetching after that many rows too
+    /// </summary>
+    sharded_query& limit(size_t rows)
+    {
+        m_limit = rows;
+        return *this;
+    }
+
+    /// <summary>
+    /// Number of rows in a block passed from a shard thread to the consumer, 256 by default
+    /// </summary>
+    sharded_query& block_rows(unsigned rows)
+    {
+        m_block_rows = rows ? rows : 1;
+        return *this;
+    }
+
+    /// <summary>
+    /// Execute the query on all shards and pass every row to a callback, on the calling thread
+    /// </summary>
+    /// <param name="on_row">- callable, takes <em>row const&amp;</em> and shard number</param>
+    /// <param name="args">- query parameters, the same for every shard</param>
+    /// <returns>delivered rows count</returns>
+    template <typename OnRow, typename ...Args>
+    size_t run(OnRow&& on_row, Args const& ...args)
+    {
+        run_state state{ m_shards.size() };
+        for (size_t i = 0; i < m_shards.size(); ++i)
+        {
+            state.threads.emplace_back([this, &state, i, &args...]
+                {
+                    produce(state, i, [&](transaction& tr) { return tr.cursor(m_sql.c_str(), args...); });
+                });
+        }
+
+        if (m_merge)
+            return merge(state, on_row);
+        else
+            return concatenate(state, on_row);
+    }
+
+private:
+    struct shard_stream
+    {
+        shard_stream() = default;
+        shard_stream(shard_stream const&) = delete;
+        shard_stream& operator=(shard_stream const&) = delete;
+
+        ~shard_stream()
+        {
+            if (meta)
+                meta->release();
+        }
+
+        Firebird::IMessageMetadata* meta{};
+        unsigned stride{};
+
+        // producer side, guarded by run_state::mutex
+        std::vector<unsigned char> ready;
+        size_t ready_rows{};
+        bool has_ready{};
+        bool done{};
+        std::exception_ptr error;
+
+        // consumer side
+        std::vector<unsigned char> current;
+        size_t current_rows{};
+        size_t pos{};
+
+        const unsigned char* at() const
+        {
+            return current.data() + pos * stride;
+        }
+    };
+
+    struct run_state
+    {
+        run_state(size_t count)
+            : streams(count)
+        {}
+
+        // stops the producers even when the consumer leaves early or throws
+        ~run_state()
+        {
+            {
+                std::lock_guard<std::mutex> lock{ mutex };
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& t : threads)
+                t.join();
+        }
+
+        std::vector<shard_stream> streams;
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stop{};
+    };
+
+    template <typename Open>
+    void produce(run_state& state, size_t index, Open open)
+    {
+        auto& stream = state.streams[index];
+        try
+        {
+            auto tr = m_shards[index]->start(isolation_level::read_committed(true), lock_resolution::wait(), data_access::read_only());
+            auto rs = open(tr);
+
+            auto meta = rs.current().metadata();
+            meta->addRef();
+            stream.meta = meta;
+            auto length = meta->getMessageLength(&_detail::status());
+            stream.stride = meta->getAlignedLength(&_detail::status());
+
+            std::vector<unsigned char> filling;
+            filling.reserve(static_cast<size_t>(stream.stride) * m_block_rows);
+            size_t fetched = 0;
+            size_t rows = 0;
+            for (;;)
+            {
+                bool more = (m_limit == 0 || fetched < m_limit) && rs.next();
+                if (more)
+                {
+                    auto r = rs.current();
+                    filling.resize(filling.size() + stream.stride);
+                    memcpy(filling.data() + filling.size() - stream.stride, r.data(), length);
+                    ++fetched;
+                    ++rows;
+                }
+
+                if (rows == m_block_rows || (!more && rows > 0))
+                {
+                    std::unique_lock<std::mutex> lock{ state.mutex };
+                    state.cv.wait(lock, [&] { return !stream.has_ready || state.stop; });
+                    if (state.stop)
+                        return;
+                    std::swap(stream.ready, filling);
+                    stream.ready_rows = rows;
+                    stream.has_ready = true;
+                    lock.unlock();
+                    state.cv.notify_all();
+
+                    filling.clear();
+                    rows = 0;
+                }
+
+                if (!more)
+                    break;
+            }
+
+            rs.close();
+            tr.commit();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock{ state.mutex };
+            stream.error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ state.mutex };
+            stream.done = true;
+        }
+        state.cv.notify_all();
+    }
+
+    // moves a ready block to the consumer side, the caller holds the lock
+    static bool take(run_state& state, shard_stream& stream)
+    {
+        if (stream.error)
+            std::rethrow_exception(stream.error);
+        if (!stream.has_ready)
+            return false;
+
+        std::swap(stream.current, stream.ready);
+        stream.current_rows = stream.ready_rows;
+        stream.pos = 0;
+        stream.has_ready = false;
+        state.cv.notify_all();
+        return true;
+    }
+
+    // waits for the next block of a shard, false when the shard is exhausted
+    static bool next_block(run_state& state, shard_stream& stream)
+    {
+        std::unique_lock<std::mutex> lock{ state.mutex };
+        state.cv.wait(lock, [&] { return stream.has_ready || stream.done; });
+        return take(state, stream);
+    }
+
+    template <typename OnRow>
+    size_t concatenate(run_state& state, OnRow& on_row)
+    {
+        size_t delivered = 0;
+        size_t count = state.streams.size();
+        size_t next = 0;
+        for (;;)
+        {
+            size_t index = count;
+            {
+                std::unique_lock<std::mutex> lock{ state.mutex };
+                auto pick = [&]
+                {
+                    bool all_done = true;
+                    for (size_t n = 0; n < count; ++n)
+                    {
+                        auto i = (next + n) % count;
+                        auto& s = state.streams[i];
+                        if (s.has_ready || s.error)
+                        {
+                            index = i;
+                            return true;
+                        }
+                        all_done = all_done && s.done;
+                    }
+                    return all_done;
+                };
+                state.cv.wait(lock, pick);
+                if (index == count)
+                    return delivered;
+                take(state, state.streams[index]);
+            }
+
+            auto& stream = state.streams[index];
+            for (; stream.pos < stream.current_rows; ++stream.pos)
+            {
+                on_row(row{ stream.meta, stream.at() }, index);
+                if (++delivered == m_limit)
+                    return delivered;
+            }
+            next = index + 1;
+        }
+    }
+
+    template <typename OnRow>
+    size_t merge(run_state& state, OnRow& on_row)
+    {
+        auto& streams = state.streams;
+        std::vector<size_t> active;
+        for (size_t i = 0; i < streams.size(); ++i)
+        {
+            if (next_block(state, streams[i]))
+                active.push_back(i);
+        }
+        if (active.empty())
+            return 0;
+
+        auto meta = streams[active.front()].meta;
+        if (m_key_column >= meta->getCount(&_detail::status()))
+            throw logic_error("sharded_query - key column index out of bounds");
+        for (auto i : active)
+        {
+            if (streams[i].stride != streams[active.front()].stride)
+                throw logic_error("sharded_query - shards return different row layouts");
+        }
+
+        auto key = _detail::make_key_part(meta, m_key_column);
+        bool descending = m_descending;
+        // the heap top is the shard with the smallest (or greatest) current key
+        auto after = [&](size_t a, size_t b)
+        {
+            int rc = _detail::compare(key, streams[a].at(), streams[b].at());
+            return descending ? rc < 0 : rc > 0;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(after)> heap{ after, std::move(active) };
+
+        size_t delivered = 0;
+        while (!heap.empty())
+        {
+            auto index = heap.top();
+            heap.pop();
+
+            auto& stream = streams[index];
+            on_row(row{ stream.meta, stream.at() }, index);
+            if (++delivered == m_limit)
+                break;
+
+            if (++stream.pos < stream.current_rows || next_block(state, stream))
+                heap.push(index);
+        }
+        return delivered;
+    }
+
+private:
+    std::vector<connection*> m_shards;
+    std::string m_sql;
+    bool m_merge{};
+    unsigned m_key_column{};
+    bool m_descending{};
+    size_t m_limit{};
+    unsigned m_block_rows{ 256 };
+};
+
+} // namespace fbsqlxx
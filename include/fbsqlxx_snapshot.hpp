@@ -0,0 +1,460 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_index.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace fbsqlxx {
+
+struct snapshot_options
+{
+    const char* freshness_query{};  // one value which changes with the data, e.g. "select max(changed_at) from rates"
+    const char* top_up_query{};     // rows changed after the saved freshness value, which is its only parameter
+    std::vector<unsigned> key_columns;  // top-up rows replace saved rows of the same key; without a key they are
+                                        // appended, which suits insert-only data
+    const char* deleted_query{};    // keys of rows deleted after the saved freshness value, the key columns in order
+};
+
+
+namespace _detail {
+
+// File layout: header, column descriptions with their names, the freshness value,
+// then the row messages from a page boundary, one after another at the aligned message length.
+// Rows are written in the client's native format and mapped back as they are.
+static constexpr char snapshot_magic[8] = { 'F', 'B', 'S', 'Q', 'L', 'X', 'X', 'S' };
+static constexpr uint32_t snapshot_version = 1;
+static constexpr uint32_t snapshot_byte_order = 0x01020304;
+static constexpr uint64_t snapshot_alignment = 4096;
+
+struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t columns;
+    uint32_t message_length;
+    uint32_t stride;
+    uint32_t freshness_length;
+    uint64_t rows;
+    uint64_t rows_offset;
+};
+
+struct snapshot_column
+{
+    uint32_t type;
+    int32_t sub_type;
+    uint32_t length;
+    int32_t scale;
+    uint32_t charset;
+    uint32_t offset;
+    uint32_t null_offset;
+    uint32_t name_length;
+    uint32_t alias_length;
+};
+
+// read-only file mapping
+class mapped_file
+{
+public:
+    explicit mapped_file(const char* path)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            throw logic_error("fbsqlxx::open_snapshot() - can not open the file");
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(m_file, &size) && size.QuadPart > 0)
+        {
+            m_size = static_cast<size_t>(size.QuadPart);
+            m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_mapping)
+                m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (!m_data)
+        {
+            close();
+            throw logic_error("fbsqlxx::open_snapshot() - can not map the file");
+        }
+#else
+        auto fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            throw logic_error("fbsqlxx::open_snapshot() - can not open the file");
+        struct stat st;
+        void* data = MAP_FAILED;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            m_size = static_cast<size_t>(st.st_size);
+            data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (data == MAP_FAILED)
+            throw logic_error("fbsqlxx::open_snapshot() - can not map the file");
+        m_data = static_cast<const unsigned char*>(data);
+#endif
+    }
+
+    ~mapped_file()
+    {
+        close();
+    }
+
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    void close()
+    {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+#else
+        if (m_data)
+            ::munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+        m_data = nullptr;
+    }
+
+#ifdef _WIN32
+    HANDLE m_file{ INVALID_HANDLE_VALUE };
+    HANDLE m_mapping{};
+#endif
+    const unsigned char* m_data{};
+    size_t m_size{};
+};
+
+// blob ids are valid only in the attachment which fetched them, a snapshot can't keep them
+static inline void check_snapshot_type(unsigned type, const char* where)
+{
+    type &= ~1u;
+    if (type == SQL_BLOB || type == SQL_ARRAY)
+        throw logic_error((std::string{ where } + " - BLOB and ARRAY columns can not be saved").c_str());
+}
+
+// freshness value as text, it goes back to the server as the top-up query parameter
+static inline std::string snapshot_freshness(transaction& tr, const char* query)
+{
+    auto sql = std::string{ "select cast((" } + query + ") as varchar(64)) from rdb$database";
+    auto rs = tr.cursor(sql.c_str());
+    std::string res;
+    if (rs.next() && !rs.get(0).is_null())
+        res = rs.get(0).as<std::string>();
+    rs.close();
+    return res;
+}
+
+// saved rows with the keys of top-up or deleted rows are dropped, top-up rows go to the end
+static inline row_table merge_top_up(row_table&& table, row_table const& changed, row_table const* deleted,
+    std::vector<unsigned> const& key_columns)
+{
+    std::unordered_set<std::string> keys;
+    std::string key;
+    auto collect = [&](row_table const& rows, std::vector<key_part> const& parts)
+    {
+        for (auto r : rows)
+        {
+            key.clear();
+            for (auto const& p : parts)
+                encode_key(p, r.data(), key);
+            keys.insert(key);
+        }
+    };
+
+    auto parts = make_key_parts(table, key_columns);
+    collect(changed, parts);
+    if (deleted)
+    {
+        std::vector<unsigned> columns(key_columns.size());
+        std::iota(columns.begin(), columns.end(), 0u);
+        collect(*deleted, make_key_parts(*deleted, columns));
+    }
+
+    std::vector<bool> dropped(table.size());
+    bool any = false;
+    for (size_t i = 0; i < table.size() && !keys.empty(); ++i)
+    {
+        key.clear();
+        for (auto const& p : parts)
+            encode_key(p, table[i].data(), key);
+        if (keys.count(key))
+            dropped[i] = any = true;
+    }
+
+    // only new rows, the saved ones stay where they are
+    if (!any)
+    {
+        for (auto r : changed)
+            table.push_back(r);
+        return std::move(table);
+    }
+
+    row_table res{ table.metadata(), nullptr, 0, {} };
+    for (size_t i = 0; i < table.size(); ++i)
+    {
+        if (!dropped[i])
+            res.push_back(table[i]);
+    }
+    for (auto r : changed)
+        res.push_back(r);
+    return res;
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Save rows to a file which open_snapshot() maps back into memory. The file is written next to
+/// the target and renamed over it, so a snapshot being read is never seen half written.
+/// BLOB and ARRAY columns are rejected: a blob id can be opened only by the attachment which fetched it.
+/// </summary>
+/// <param name="table">- materialized rows</param>
+/// <param name="path">- snapshot file</param>
+/// <param name="freshness">- value telling which data the rows are, returned by open_snapshot()</param>
+static inline void save_snapshot(row_table const& table, const char* path, std::string const& freshness = {})
+{
+    using namespace _detail;
+
+    auto meta = table.metadata();
+    if (!meta)
+        throw logic_error("fbsqlxx::save_snapshot() - table has no row format");
+
+    auto& st = status();
+    std::vector<unsigned char> head(sizeof(snapshot_header));
+    auto put = [&head](const void* data, size_t size)
+    {
+        auto from = static_cast<const unsigned char*>(data);
+        head.insert(head.end(), from, from + size);
+    };
+
+    snapshot_header h{};
+    std::copy(std::begin(snapshot_magic), std::end(snapshot_magic), h.magic);
+    h.version = snapshot_version;
+    h.byte_order = snapshot_byte_order;
+    h.columns = meta->getCount(&st);
+    h.message_length = meta->getMessageLength(&st);
+    h.stride = meta->getAlignedLength(&st);
+    h.freshness_length = static_cast<uint32_t>(freshness.size());
+    h.rows = table.size();
+
+    for (unsigned i = 0; i < h.columns; ++i)
+    {
+        check_snapshot_type(meta->getType(&st, i), "fbsqlxx::save_snapshot()");
+        std::string name = meta->getField(&st, i);
+        std::string alias = meta->getAlias(&st, i);
+        snapshot_column c{};
+        c.type = meta->getType(&st, i) | (meta->isNullable(&st, i) ? 1u : 0u);
+        c.sub_type = meta->getSubType(&st, i);
+        c.length = meta->getLength(&st, i);
+        c.scale = meta->getScale(&st, i);
+        c.charset = meta->getCharSet(&st, i);
+        c.offset = meta->getOffset(&st, i);
+        c.null_offset = meta->getNullOffset(&st, i);
+        c.name_length = static_cast<uint32_t>(name.size());
+        c.alias_length = static_cast<uint32_t>(alias.size());
+        put(&c, sizeof(c));
+        put(name.data(), name.size());
+        put(alias.data(), alias.size());
+    }
+    put(freshness.data(), freshness.size());
+
+    h.rows_offset = (head.size() + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+    head.resize(static_cast<size_t>(h.rows_offset));
+    memcpy(head.data(), &h, sizeof(h));
+
+    std::string temp = std::string{ path } + ".tmp";
+    auto file = std::fopen(temp.c_str(), "wb");
+    if (!file)
+        throw logic_error("fbsqlxx::save_snapshot() - can not create the file");
+
+    std::setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+    bool ok = std::fwrite(head.data(), 1, head.size(), file) == head.size();
+    for (auto it = table.begin(); ok && it != table.end(); ++it)
+        ok = std::fwrite((*it).data(), 1, h.stride, file) == h.stride;
+    ok = std::fclose(file) == 0 && ok;
+
+    std::error_code ec;
+    if (ok)
+        std::filesystem::rename(temp, path, ec);
+    if (!ok || ec)
+    {
+        std::filesystem::remove(temp, ec);
+        throw logic_error("fbsqlxx::save_snapshot() - write to file failed");
+    }
+}
+
+/// <summary>
+/// Map a snapshot file into memory. Only the column descriptions are read, the rows are used
+/// where they lie in the mapping, which stays open as long as the table.
+/// </summary>
+/// <param name="path">- file written by save_snapshot()</param>
+/// <param name="freshness">- receives the saved freshness value, optional</param>
+static inline row_table open_snapshot(const char* path, std::string* freshness = nullptr)
+{
+    using namespace _detail;
+
+    auto file = std::make_shared<mapped_file>(path);
+    auto data = file->data();
+    auto size = file->size();
+
+    snapshot_header h;
+    if (size < sizeof(h))
+        throw logic_error("fbsqlxx::open_snapshot() - file is not a snapshot");
+    memcpy(&h, data, sizeof(h));
+    if (!std::equal(std::begin(snapshot_magic), std::end(snapshot_magic), h.magic))
+        throw logic_error("fbsqlxx::open_snapshot() - file is not a snapshot");
+    if (h.version != snapshot_version || h.byte_order != snapshot_byte_order)
+        throw logic_error("fbsqlxx::open_snapshot() - snapshot version or byte order differs");
+    if (h.columns == 0 || h.stride == 0 || h.rows_offset > size || h.rows > (size - h.rows_offset) / h.stride)
+        throw logic_error("fbsqlxx::open_snapshot() - snapshot is truncated");
+
+    // same types in the same order give the same layout, which the stored offsets confirm
+    auto& st = status();
+    std::vector<snapshot_column> columns(h.columns);
+    size_t pos = sizeof(h);
+    auto builder = make_autodestroy(master()->getMetadataBuilder(&st, h.columns));
+    for (unsigned i = 0; i < h.columns; ++i)
+    {
+        auto& c = columns[i];
+        if (pos + sizeof(c) > h.rows_offset)
+            throw logic_error("fbsqlxx::open_snapshot() - snapshot is truncated");
+        memcpy(&c, data + pos, sizeof(c));
+        pos += sizeof(c);
+        if (pos + c.name_length + c.alias_length > h.rows_offset)
+            throw logic_error("fbsqlxx::open_snapshot() - snapshot is truncated");
+        std::string name{ reinterpret_cast<const char*>(data + pos), c.name_length };
+        pos += c.name_length;
+        std::string alias{ reinterpret_cast<const char*>(data + pos), c.alias_length };
+        pos += c.alias_length;
+
+        builder->setType(&st, i, c.type);
+        builder->setSubType(&st, i, c.sub_type);
+        builder->setLength(&st, i, c.length);
+        builder->setScale(&st, i, c.scale);
+        builder->setCharSet(&st, i, c.charset);
+        builder->setField(&st, i, name.c_str());
+        builder->setAlias(&st, i, alias.c_str());
+    }
+    if (pos + h.freshness_length > h.rows_offset)
+        throw logic_error("fbsqlxx::open_snapshot() - snapshot is truncated");
+    if (freshness)
+        freshness->assign(reinterpret_cast<const char*>(data + pos), h.freshness_length);
+
+    auto meta = make_autodestroy(builder->getMetadata(&st));
+    bool same = meta->getMessageLength(&st) == h.message_length && meta->getAlignedLength(&st) == h.stride;
+    for (unsigned i = 0; same && i < h.columns; ++i)
+        same = meta->getOffset(&st, i) == columns[i].offset && meta->getNullOffset(&st, i) == columns[i].null_offset;
+    if (!same)
+        throw logic_error("fbsqlxx::open_snapshot() - row layout differs from this client");
+
+    return row_table{ &meta, data + h.rows_offset, static_cast<size_t>(h.rows), file };
+}
+
+/// <summary>
+/// Rows of a query, from a snapshot file when it is fresh. The freshness query is compared with the
+/// value saved in the snapshot; when they differ the top-up query fetches the changed rows,
+/// or the whole query is run again without one. With key columns the changed rows replace saved rows
+/// of the same key and the keys of the deleted query are removed, without them the changed rows are
+/// appended. A new snapshot is saved whenever rows were fetched. Indexes over the rows are built anew
+/// after loading. The query can't return BLOB or ARRAY columns.
+/// </summary>
+/// <param name="conn">- connection</param>
+/// <param name="query">- query of all rows</param>
+/// <param name="path">- snapshot file</param>
+/// <param name="options">- freshness and top-up queries, a snapshot is always fresh without them</param>
+static inline row_table load_snapshot(connection& conn, const char* query, const char* path,
+    snapshot_options const& options = {})
+{
+    using namespace _detail;
+
+    auto tr = conn.start(isolation_level::concurrency(), lock_resolution::wait(), data_access::read_only());
+    auto fresh = options.freshness_query ? snapshot_freshness(tr, options.freshness_query) : std::string{};
+
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec))
+    {
+        try
+        {
+            std::string saved;
+            auto table = open_snapshot(path, &saved);
+            if (!options.freshness_query || saved == fresh)
+            {
+                tr.commit();
+                return table;
+            }
+            if (options.top_up_query && !saved.empty())
+            {
+                auto rs = tr.cursor(options.top_up_query, saved);
+                if (options.key_columns.empty())
+                    rs.materialize(table);
+                else
+                {
+                    auto changed = rs.materialize();
+                    if (!table.same_format(changed.metadata()))
+                        throw logic_error("fbsqlxx::load_snapshot() - top-up rows differ from the snapshot");
+                    std::optional<row_table> deleted;
+                    if (options.deleted_query)
+                    {
+                        auto drs = tr.cursor(options.deleted_query, saved);
+                        deleted = drs.materialize();
+                        drs.close();
+                    }
+                    table = merge_top_up(std::move(table), changed, deleted ? &*deleted : nullptr, options.key_columns);
+                }
+                rs.close();
+                tr.commit();
+                try
+                {
+                    save_snapshot(table, path, fresh);
+                }
+                catch (const logic_error&)
+                {
+                    // the mapped snapshot may not be replaceable, it is topped up again next time
+                }
+                return table;
+            }
+        }
+        catch (const logic_error&)
+        {
+            // unreadable snapshot or changed row format, load everything
+        }
+    }
+
+    auto rs = tr.cursor(query);
+    for (auto type : rs.types())
+        check_snapshot_type(type, "fbsqlxx::load_snapshot()");
+    auto table = rs.materialize();
+    rs.close();
+    tr.commit();
+    save_snapshot(table, path, fresh);
+    return table;
+}
+
+} // namespace fbsqlxx
@@ -0,0 +1,524 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_service.hpp"
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+enum class trace_event_type
+{
+    attach, detach,
+    transaction_start, transaction_commit, transaction_rollback,
+    statement_prepare, statement_start, statement_finish,
+    other
+};
+
+/// <summary>
+/// Event of the trace stream, fields not printed for the event are left empty
+/// </summary>
+struct trace_event
+{
+    trace_event_type type{ trace_event_type::other };
+    std::string name;               // event name as printed, e.g. EXECUTE_STATEMENT_FINISH
+    std::string timestamp;          // server time as printed
+    bool failed{};                  // FAILED or UNAUTHORIZED event
+    std::string database;
+    std::string user;
+    std::string remote;             // remote protocol and address
+    int64_t attachment_id{};
+    int64_t transaction_id{};
+    int64_t statement_id{};
+    std::string sql;
+    std::string plan;
+    int64_t records{};              // fetched or affected
+    std::chrono::milliseconds elapsed{};
+    int64_t reads{};
+    int64_t writes{};
+    int64_t fetches{};
+    int64_t marks{};
+};
+
+
+namespace _detail {
+
+// single producer, single consumer ring of fixed capacity, never blocks
+template <typename T>
+class spsc_ring
+{
+public:
+    explicit spsc_ring(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_items.resize(size);
+        m_mask = size - 1;
+    }
+
+    bool try_push(T&& value)
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+            return false;
+        m_items[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        value = std::move(m_items[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> m_items;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_head{};
+    alignas(64) std::atomic<size_t> m_tail{};
+};
+
+static inline bool starts_with(std::string const& s, const char* prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// number right before the suffix, e.g. " read(s)" in "0 ms, 2 read(s), 10 fetch(es)"
+static inline int64_t number_before(std::string const& line, const char* suffix)
+{
+    auto pos = line.find(suffix);
+    if (pos == std::string::npos)
+        return 0;
+    auto begin = pos;
+    while (begin > 0 && isdigit(static_cast<unsigned char>(line[begin - 1])))
+        --begin;
+    return begin == pos ? 0 : std::strtoll(line.c_str() + begin, nullptr, 10);
+}
+
+// number right after the prefix, e.g. "ATT_" in "(ATT_12, SYSDBA:NONE, UTF8, TCPv4:127.0.0.1)"
+static inline int64_t number_after(std::string const& line, const char* prefix)
+{
+    auto pos = line.find(prefix);
+    if (pos == std::string::npos)
+        return 0;
+    return std::strtoll(line.c_str() + pos + strlen(prefix), nullptr, 10);
+}
+
+static inline trace_event_type trace_type_of(std::string const& name)
+{
+    static const std::pair<const char*, trace_event_type> types[] = {
+        { "ATTACH_DATABASE", trace_event_type::attach },
+        { "DETACH_DATABASE", trace_event_type::detach },
+        { "START_TRANSACTION", trace_event_type::transaction_start },
+        { "COMMIT_TRANSACTION", trace_event_type::transaction_commit },
+        { "COMMIT_RETAINING", trace_event_type::transaction_commit },
+        { "ROLLBACK_TRANSACTION", trace_event_type::transaction_rollback },
+        { "ROLLBACK_RETAINING", trace_event_type::transaction_rollback },
+        { "PREPARE_STATEMENT", trace_event_type::statement_prepare },
+        { "EXECUTE_STATEMENT_START", trace_event_type::statement_start },
+        { "EXECUTE_STATEMENT_FINISH", trace_event_type::statement_finish },
+    };
+    for (auto const& t : types)
+        if (name == t.first)
+            return t.second;
+    return trace_event_type::other;
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Turns lines of the standard trace plugin output into events
+/// </summary>
+class trace_parser final
+{
+public:
+    /// <summary>
+    /// Parse one line, a complete event is passed to the callback when the next one starts
+    /// </summary>
+    template <typename OnEvent>
+    void feed(std::string const& line, OnEvent&& on_event)
+    {
+        using namespace _detail;
+
+        if (is_header(line))
+        {
+            flush(on_event);
+            start(line);
+            return;
+        }
+        if (!m_active)
+            return;
+
+        switch (m_section)
+        {
+        case section::sql:
+            if (starts_with(line, "^^^"))
+                m_section = section::plan;
+            else if (line.empty())
+                m_section = section::tail;
+            else
+                append(m_event.sql, line);
+            return;
+
+        case section::plan:
+            // the plan text starts with a line break, so an empty line comes first
+            if (line.find(" records fetched") != std::string::npos || line.find(" records affected") != std::string::npos
+                || is_perf(line))
+            {
+                m_section = section::tail;
+                break;
+            }
+            if (!line.empty())
+                append(m_event.plan, line);
+            else if (!m_event.plan.empty())
+                m_section = section::tail;
+            return;
+
+        case section::sql_start:
+            m_section = section::sql; // the dashes line
+            return;
+
+        default:
+            break;
+        }
+
+        if (line.find("(ATT_") != std::string::npos)
+        {
+            m_event.attachment_id = number_after(line, "(ATT_");
+            auto first = line.find_first_not_of(" \t");
+            auto open = line.find(" (ATT_");
+            if (first != std::string::npos && open > first)
+                m_event.database = line.substr(first, open - first);
+
+            // (ATT_n, USER:ROLE, CHARSET, PROTOCOL:ADDRESS)
+            auto user = line.find(", ", open);
+            if (user != std::string::npos)
+            {
+                auto colon = line.find(':', user);
+                auto comma = line.find(", ", user + 2);
+                if (colon != std::string::npos && colon < comma)
+                    m_event.user = line.substr(user + 2, colon - user - 2);
+                auto remote = comma == std::string::npos ? comma : line.find(", ", comma + 2);
+                auto close = line.rfind(')');
+                if (remote != std::string::npos && close != std::string::npos && close > remote)
+                    m_event.remote = line.substr(remote + 2, close - remote - 2);
+            }
+        }
+        else if (line.find("(TRA_") != std::string::npos)
+            m_event.transaction_id = number_after(line, "(TRA_");
+        else if (starts_with(line, "Statement ") && !line.empty() && line.back() == ':')
+        {
+            m_event.statement_id = number_after(line, "Statement ");
+            m_section = section::sql_start;
+        }
+        else if (line.find(" records fetched") != std::string::npos)
+            m_event.records = number_before(line, " records fetched");
+        else if (line.find(" records affected") != std::string::npos)
+            m_event.records = number_before(line, " records affected");
+        else if (is_perf(line))
+        {
+            m_event.elapsed = std::chrono::milliseconds{ number_before(line, " ms") };
+            m_event.reads = number_before(line, " read(s)");
+            m_event.writes = number_before(line, " write(s)");
+            m_event.fetches = number_before(line, " fetch(es)");
+            m_event.marks = number_before(line, " mark(s)");
+        }
+    }
+
+    /// <summary>
+    /// Pass the event being parsed to the callback, e.g. when the stream pauses
+    /// </summary>
+    template <typename OnEvent>
+    void flush(OnEvent&& on_event)
+    {
+        if (!m_active)
+            return;
+        m_active = false;
+        on_event(std::move(m_event));
+        m_event = trace_event{};
+    }
+
+private:
+    enum class section
+    {
+        header, sql_start, sql, plan, tail
+    };
+
+    // 2024-01-15T10:20:30.1230 (1234:0x7f4c58b3e1c0) EXECUTE_STATEMENT_FINISH
+    static bool is_header(std::string const& line)
+    {
+        return line.size() > 20 && isdigit(static_cast<unsigned char>(line[0])) && line[4] == '-' && line[10] == 'T'
+            && line.find(" (") != std::string::npos;
+    }
+
+    // "      0 ms, 2 read(s), 10 fetch(es), 1 mark(s)"
+    static bool is_perf(std::string const& line)
+    {
+        auto first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || !isdigit(static_cast<unsigned char>(line[first])))
+            return false;
+        auto last = line.find_first_not_of("0123456789", first);
+        return last != std::string::npos && line.compare(last, 3, " ms") == 0;
+    }
+
+    void start(std::string const& line)
+    {
+        m_active = true;
+        m_section = section::header;
+        auto space = line.find(' ');
+        m_event.timestamp = line.substr(0, space);
+
+        auto close = line.find(") ", space);
+        auto name = close == std::string::npos ? std::string{} : line.substr(close + 2);
+        for (auto prefix : { "FAILED ", "UNAUTHORIZED " })
+        {
+            if (_detail::starts_with(name, prefix))
+            {
+                m_event.failed = true;
+                name.erase(0, strlen(prefix));
+            }
+        }
+        m_event.type = _detail::trace_type_of(name);
+        m_event.name = std::move(name);
+    }
+
+    static void append(std::string& text, std::string const& line)
+    {
+        if (!text.empty())
+            text += '\n';
+        text += line;
+    }
+
+private:
+    trace_event m_event;
+    section m_section{ section::header };
+    bool m_active{};
+};
+
+
+/// <summary>
+/// User trace session run by the services manager. A background thread reads the trace
+/// stream, parses it and pushes events into a lock-free ring, the consumer pops them on its
+/// own thread. Events are dropped, and counted, when the consumer falls behind.
+/// </summary>
+class trace_session final
+{
+public:
+    /// <summary>
+    /// Start a trace session
+    /// </summary>
+    /// <param name="params">- services manager connection parameters</param>
+    /// <param name="config">- trace configuration, see default_config()</param>
+    /// <param name="name">- session name, shown by fbtracemgr -list</param>
+    /// <param name="capacity">- number of events the ring holds</param>
+    trace_session(service_params const& params, std::string const& config, std::string const& name = "fbsqlxx",
+        size_t capacity = 4096)
+        : m_params{ params }, m_ring{ capacity }
+    {
+        if (m_params.server)
+        {
+            m_server = m_params.server;
+            m_params.server = m_server.c_str();
+        }
+        keep(m_user, m_params.user);
+        keep(m_password, m_params.password);
+        keep(m_role, m_params.role);
+
+        auto svc = std::make_unique<service>(m_params);
+        service_action action{ isc_action_svc_trace_start };
+        action.add(isc_spb_trc_name, name).add(isc_spb_trc_cfg, config);
+        svc->start(action);
+
+        m_thread = std::thread{ &trace_session::run, this, std::move(svc) };
+    }
+
+    /// <summary>
+    /// Stop the session and the reading thread
+    /// </summary>
+    ~trace_session()
+    {
+        m_stop.store(true, std::memory_order_relaxed);
+        m_thread.join();
+    }
+
+    trace_session(trace_session const&) = delete;
+    trace_session& operator=(trace_session const&) = delete;
+
+    /// <summary>
+    /// Trace configuration logging connections, transactions and statements with plans and counters
+    /// </summary>
+    /// <param name="database">- database file name or regular expression, all databases when empty</param>
+    static std::string default_config(std::string const& database = "")
+    {
+        return "database" + (database.empty() ? std::string{} : " = " + database) + "\n"
+            "{\n"
+            "    enabled = true\n"
+            "    log_connections = true\n"
+            "    log_transactions = true\n"
+            "    log_statement_prepare = true\n"
+            "    log_statement_start = true\n"
+            "    log_statement_finish = true\n"
+            "    print_plan = true\n"
+            "    print_perf = true\n"
+            "    time_threshold = 0\n"
+            "}\n";
+    }
+
+    /// <summary>
+    /// Take the oldest event, must be called by one thread at a time
+    /// </summary>
+    /// <returns>false if there are no events now</returns>
+    bool try_pop(trace_event& event)
+    {
+        return m_ring.try_pop(event);
+    }
+
+    /// <summary>
+    /// Session id assigned by the server, zero until the server reports it
+    /// </summary>
+    int64_t id() const
+    {
+        return m_id.load(std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Events lost because the ring was full
+    /// </summary>
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// False after the stream ended or failed
+    /// </summary>
+    bool running() const
+    {
+        return !m_finished.load(std::memory_order_acquire);
+    }
+
+    /// <summary>
+    /// Rethrow the error which stopped the reading thread, if any
+    /// </summary>
+    void check() const
+    {
+        if (m_finished.load(std::memory_order_acquire) && m_error)
+            std::rethrow_exception(m_error);
+    }
+
+private:
+    static void keep(std::string& storage, const char*& value)
+    {
+        if (value)
+        {
+            storage = value;
+            value = storage.c_str();
+        }
+    }
+
+    void push(trace_event&& event)
+    {
+        if (!m_ring.try_push(std::move(event)))
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void run(std::unique_ptr<service> svc)
+    {
+        try
+        {
+            trace_parser parser;
+            auto on_event = [this](trace_event&& e) { push(std::move(e)); };
+            std::string text;
+            std::string line;
+            bool stopping = false;
+            for (;;)
+            {
+                if (!stopping && m_stop.load(std::memory_order_relaxed))
+                {
+                    stopping = true;
+                    stop_session();
+                    if (id() == 0)
+                        break;  // the stream can't be stopped by id, detaching ends it
+                }
+
+                auto rc = svc->read_text(text, 1);
+                if (rc == service_output::end)
+                    break;
+                if (rc == service_output::timeout)
+                {
+                    parser.flush(on_event); // the trace prints whole events, a pause ends one
+                    continue;
+                }
+
+                for (auto c : text)
+                {
+                    if (c != '\n')
+                    {
+                        if (c != '\r')
+                            line += c;
+                        continue;
+                    }
+
+                    // the first line is "Trace session ID 12 started"
+                    if (id() == 0 && _detail::starts_with(line, "Trace session ID "))
+                        m_id.store(_detail::number_after(line, "Trace session ID "), std::memory_order_relaxed);
+                    else
+                        parser.feed(line, on_event);
+                    line.clear();
+                }
+            }
+            parser.flush(on_event);
+        }
+        catch (...)
+        {
+            m_error = std::current_exception();
+        }
+        m_finished.store(true, std::memory_order_release);
+    }
+
+    // trace output blocks the reading attachment, the stop request goes through another one
+    void stop_session()
+    {
+        if (id() == 0)
+            return;
+        service svc{ m_params };
+        service_action action{ isc_action_svc_trace_stop };
+        action.add(isc_spb_trc_id, static_cast<int>(id()));
+        svc.start(action);
+        svc.wait();
+    }
+
+private:
+    service_params m_params;
+    std::string m_server;
+    std::string m_user;
+    std::string m_password;
+    std::string m_role;
+
+    _detail::spsc_ring<trace_event> m_ring;
+    std::thread m_thread;
+    std::atomic<bool> m_stop{};
+    std::atomic<bool> m_finished{};
+    std::atomic<int64_t> m_id{};
+    std::atomic<uint64_t> m_dropped{};
+    std::exception_ptr m_error;
+};
+
+} // namespace fbsqlxx
@@ -0,0 +1,216 @@
+#pragma once
+
+#include "fbsqlxx.hpp"
+#include "fbsqlxx_schema.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+
+namespace fbsqlxx {
+
+struct upsert_result
+{
+    uint64_t inserted{};
+    uint64_t updated{};
+};
+
+struct upsert_options
+{
+    size_t batch_size{ 1000 };      // rows per round trip
+    const char* staging_table{};    // global temporary table with the same columns, rows are merged with one MERGE when set
+};
+
+
+namespace _detail {
+
+template <typename It>
+struct row_range
+{
+    It first;
+    It last;
+    It begin() const { return first; }
+    It end() const { return last; }
+};
+
+static inline std::string join_names(std::vector<std::string> const& names, const char* prefix = "",
+    const char* separator = ", ")
+{
+    std::string res;
+    for (auto const& n : names)
+    {
+        if (!res.empty())
+            res += separator;
+        res += prefix;
+        res += n;
+    }
+    return res;
+}
+
+// name as stored in RDB$RELATIONS: unquoted names are upper case, quoted ones lose their quotes
+static inline std::string stored_name(std::string const& name)
+{
+    std::string res;
+    if (name.size() >= 2 && name.front() == '"' && name.back() == '"')
+    {
+        for (size_t i = 1; i + 1 < name.size(); ++i)
+        {
+            res += name[i];
+            if (name[i] == '"')
+                ++i;    // doubled quote
+        }
+        return res;
+    }
+    for (auto c : name)
+        res += (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+    return res;
+}
+
+static inline unsigned relation_id(transaction& tr, const char* table)
+{
+    auto rs = tr.cursor("select rdb$relation_id from rdb$relations where rdb$relation_name = ?", stored_name(table));
+    if (!rs.next())
+        throw logic_error("fbsqlxx::bulk_upsert() - table is not found");
+    auto res = rs.get(0).as<int>();
+    rs.close();
+    return static_cast<unsigned>(res);
+}
+
+// records inserted and updated in one table by the attachment so far
+static inline upsert_result modify_counts(connection const& conn, unsigned relation_id)
+{
+    static const uint8_t items[] = { isc_info_insert_count, isc_info_update_count };
+    static thread_local std::vector<uint8_t> buffer(64 * 1024);
+
+    upsert_result res;
+    for (auto i : conn.info(items, sizeof(items), buffer.data(), static_cast<unsigned>(buffer.size())))
+    {
+        // (2-byte relation id, 4-byte count) pairs
+        for (short pos = 0; pos + 6 <= i.length; pos += 6)
+        {
+            if (static_cast<unsigned>(portable_integer(i.data + pos, 2)) != relation_id)
+                continue;
+            auto count = static_cast<uint64_t>(portable_integer(i.data + pos + 2, 4));
+            (i.item == isc_info_insert_count ? res.inserted : res.updated) = count;
+        }
+    }
+    return res;
+}
+
+template <typename Rows>
+void execute_batches(statement const& st, Rows const& rows, size_t batch_size)
+{
+    auto it = std::begin(rows);
+    auto end = std::end(rows);
+    while (it != end)
+    {
+        auto first = it;
+        for (size_t n = 0; n < batch_size && it != end; ++n)
+            ++it;
+        st.execute_batch(row_range<decltype(it)>{ first, it });
+    }
+}
+
+} // namespace _detail
+
+
+/// <summary>
+/// Insert rows or update them when a row with the same key exists, a batch of rows per round trip.
+/// Without a staging table every row runs UPDATE OR INSERT, inserts and updates are told apart with
+/// the attachment's per-table counters, so triggers writing to the same table are counted as well.
+/// With a staging table the rows are batch inserted into it and merged with one MERGE.
+/// </summary>
+/// <param name="conn">- connection of the transaction</param>
+/// <param name="tr">- transaction</param>
+/// <param name="table">- target table, as written in SQL: unquoted or in double quotes</param>
+/// <param name="columns">- columns of the rows</param>
+/// <param name="key_columns">- columns identifying a row, some of the columns</param>
+/// <param name="rows">- range of <em>std::tuple</em>, an element per column</param>
+/// <param name="options">- batch size and staging table, optional</param>
+template <typename Rows>
+upsert_result bulk_upsert(connection const& conn, transaction& tr, const char* table, std::vector<std::string> const& columns,
+    std::vector<std::string> const& key_columns, Rows const& rows, upsert_options const& options = {})
+{
+    using namespace _detail;
+
+    if (columns.empty() || key_columns.empty())
+        throw logic_error("fbsqlxx::bulk_upsert() - columns and key columns must be supplied");
+
+    std::string values;
+    for (size_t i = 0; i < columns.size(); ++i)
+        values += i ? ", ?" : "?";
+    auto batch_size = options.batch_size ? options.batch_size : 1;
+
+    if (!options.staging_table)
+    {
+        auto sql = std::string{ "update or insert into " } + table + " (" + join_names(columns) + ") values (" + values
+            + ") matching (" + join_names(key_columns) + ")";
+        auto st = tr.prepare(sql.c_str());
+        auto id = relation_id(tr, table);
+
+        auto before = modify_counts(conn, id);
+        execute_batches(st, rows, batch_size);
+        auto after = modify_counts(conn, id);
+        return { after.inserted - before.inserted, after.updated - before.updated };
+    }
+
+    std::string staging{ options.staging_table };
+    auto insert = "insert into " + staging + " (" + join_names(columns) + ") values (" + values + ")";
+    execute_batches(tr.prepare(insert.c_str()), rows, batch_size);
+
+    std::string on;
+    for (auto const& k : key_columns)
+        on += (on.empty() ? "t." : " and t.") + k + " is not distinct from s." + k;
+
+    std::vector<std::string> update;
+    for (auto const& c : columns)
+    {
+        if (std::find(key_columns.begin(), key_columns.end(), c) == key_columns.end())
+            update.push_back(c);
+    }
+    std::string set;
+    for (auto const& c : update.empty() ? key_columns : update)
+        set += (set.empty() ? "t." : ", t.") + c + " = s." + c;
+
+    upsert_result res;
+    auto count = "select count(*) from " + staging + " s where exists (select 1 from " + table + " t where " + on + ")";
+    auto rs = tr.cursor(count.c_str());
+    rs.next();
+    res.updated = static_cast<uint64_t>(rs.get(0).as<int64_t>());
+    rs.close();
+
+    auto merge = "merge into " + std::string{ table } + " t using " + staging + " s on " + on
+        + " when matched then update set " + set
+        + " when not matched then insert (" + join_names(columns) + ") values (" + join_names(columns, "s.") + ")";
+    auto affected = tr.prepare(merge.c_str()).execute();
+    res.inserted = affected - res.updated;
+
+    auto clear = "delete from " + staging;
+    tr.execute(clear.c_str());
+    return res;
+}
+
+/// <summary>
+/// DDL of a staging table for bulk_upsert(): a global temporary table with the stored columns of a table
+/// </summary>
+/// <param name="table">- table from schema_cache</param>
+/// <param name="name">- name of the staging table</param>
+static inline std::string staging_table_ddl(table_info const& table, const char* name)
+{
+    std::string res = std::string{ "create global temporary table " } + name + " (";
+    bool first = true;
+    for (auto const& c : table.columns)
+    {
+        if (c.computed)
+            continue;
+        res += first ? "" : ", ";
+        res += c.name + " " + c.sql_type();
+        first = false;
+    }
+    res += ") on commit delete rows";
+    return res;
+}
+
+} // namespace fbsqlxx